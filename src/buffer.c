@@ -39,9 +39,37 @@
 /*
  * A Buffer is a memory zone used to handle all kind of data, for example an IQ
  * matrix or image buffer (which are allocated using realloc) or slice data
- * (which are mmapped from v4l's kernel space)
+ * (which is bound at creation to one of the input buffers mapped by the
+ * context, so that the data mapped by the user is never copied). Slice data
+ * passed at creation is copied there, the caller's memory is never kept. The
+ * buffer of a tiled derived image directly points to the planes of its surface
+ * and is never released. Image buffers can optionally be backed by huge pages.
  */
 
+/*
+ * Uses explicit huge pages when some are reserved, transparent ones otherwise
+ */
+static void *sunxi_cedrus_alloc_hugepages(unsigned int size,
+		unsigned int *map_size)
+{
+	void *data;
+
+	*map_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+	data = mmap(NULL, *map_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (data != MAP_FAILED)
+		return data;
+
+	data = mmap(NULL, *map_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED)
+		return NULL;
+	madvise(data, *map_size, MADV_HUGEPAGE);
+
+	return data;
+}
+
 VAStatus sunxi_cedrus_CreateBuffer(VADriverContextP ctx, VAContextID context,
 		VABufferType type, unsigned int size, unsigned int num_elements,
 		void *data, VABufferID *buf_id)
@@ -49,11 +77,8 @@ VAStatus sunxi_cedrus_CreateBuffer(VADriverContextP ctx, VAContextID context,
 	INIT_DRIVER_DATA
 	VAStatus vaStatus = VA_STATUS_SUCCESS;
 	int bufferID;
-	struct v4l2_plane plane[1];
 	object_buffer_p obj_buffer;
 
-	memset(plane, 0, sizeof(struct v4l2_plane));
-
 	/* Validate type */
 	switch (type)
 	{
@@ -79,31 +104,52 @@ VAStatus sunxi_cedrus_CreateBuffer(VADriverContextP ctx, VAContextID context,
 
 	obj_buffer->buffer_data = NULL;
 	obj_buffer->type = type;
+	obj_buffer->input_buf_index = -1;
 
 	if(obj_buffer->type == VASliceDataBufferType) {
 		object_context_p obj_context;
+		int index;
 
 		obj_context = CONTEXT(context);
 		assert(obj_context);
 
-		struct v4l2_buffer buf;
-		memset(&(buf), 0, sizeof(buf));
-		buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.index = obj_context->num_rendered_surfaces%INPUT_BUFFERS_NB;
-		buf.length = 1;
-		buf.m.planes = plane;
-
-		assert(ioctl(driver_data->mem2mem_fd, VIDIOC_QUERYBUF, &buf)==0);
-
-		obj_buffer->buffer_data = mmap(NULL, size * num_elements,
-				PROT_READ | PROT_WRITE, MAP_SHARED,
-				driver_data->mem2mem_fd, buf.m.planes[0].m.mem_offset);
-	} else
+		index = sunxi_cedrus_get_input_slot(ctx, obj_context);
+		if (size * num_elements > driver_data->input_peak)
+			driver_data->input_peak = size * num_elements;
+		if (index >= 0 &&
+		    size * num_elements > obj_context->input_slots[index].size)
+		{
+			vaStatus = sunxi_cedrus_grow_input_bufs(ctx,
+					obj_context, size * num_elements);
+			/* Fewer buffers may have been created */
+			index = obj_context->current_slot;
+		}
+		if (index < 0 && vaStatus == VA_STATUS_SUCCESS)
+			vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+		if (vaStatus != VA_STATUS_SUCCESS)
+		{
+			object_heap_free(&driver_data->buffer_heap,
+					(object_base_p) obj_buffer);
+			return vaStatus;
+		}
+		obj_buffer->input_buf_index = index;
+		obj_buffer->buffer_data = obj_context->input_slots[index].data;
+		obj_buffer->memory = BUFFER_MEMORY_CONTEXT;
+	} else if(obj_buffer->type == VAImageBufferType && driver_data->hugepages) {
+		obj_buffer->buffer_data = sunxi_cedrus_alloc_hugepages(size * num_elements,
+				&obj_buffer->map_size);
+		obj_buffer->memory = BUFFER_MEMORY_HUGEPAGES;
+	} else {
 		obj_buffer->buffer_data = realloc(obj_buffer->buffer_data, size * num_elements);
+		obj_buffer->memory = BUFFER_MEMORY_MALLOC;
+	}
 
 	if (obj_buffer->buffer_data == NULL)
+	{
+		object_heap_free(&driver_data->buffer_heap,
+				(object_base_p) obj_buffer);
 		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+	}
 
 	if (VA_STATUS_SUCCESS == vaStatus)
 	{
@@ -170,10 +216,20 @@ void sunxi_cedrus_destroy_buffer(struct sunxi_cedrus_driver_data *driver_data,
 {
 	if (NULL != obj_buffer->buffer_data)
 	{
-		if(obj_buffer->type == VASliceDataBufferType)
-			munmap(obj_buffer->buffer_data, obj_buffer->size);
-		else
-			free(obj_buffer->buffer_data);
+		switch(obj_buffer->memory) {
+			case BUFFER_MEMORY_MALLOC:
+				free(obj_buffer->buffer_data);
+				break;
+			case BUFFER_MEMORY_CONTEXT:
+				/* Mapped until the context is destroyed */
+				break;
+			case BUFFER_MEMORY_HUGEPAGES:
+				munmap(obj_buffer->buffer_data, obj_buffer->map_size);
+				break;
+			case BUFFER_MEMORY_SURFACE:
+				/* Owned by the surface */
+				break;
+		}
 
 		obj_buffer->buffer_data = NULL;
 	}
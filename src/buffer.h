@@ -34,13 +34,27 @@
 #define BUFFER(id)  ((object_buffer_p)  object_heap_lookup(&driver_data->buffer_heap,  id))
 #define BUFFER_ID_OFFSET		0x08000000
 
+/* Where the data of a buffer comes from, hence how it is released */
+enum sunxi_cedrus_buffer_memory {
+	BUFFER_MEMORY_MALLOC,
+	BUFFER_MEMORY_CONTEXT,
+	BUFFER_MEMORY_HUGEPAGES,
+	BUFFER_MEMORY_SURFACE,
+};
+
+#define HUGE_PAGE_SIZE			(2 * 1024 * 1024)
+
 struct object_buffer {
 	struct object_base base;
 	void *buffer_data;
+	enum sunxi_cedrus_buffer_memory memory;
 	int max_num_elements;
 	int num_elements;
 	VABufferType type;
 	unsigned int size;
+	unsigned int map_size;
+	/* Input buffer slice data is written into, -1 for other buffers */
+	int input_buf_index;
 };
 
 typedef struct object_buffer *object_buffer_p;
@@ -24,6 +24,7 @@
  */
 
 #include "sunxi_cedrus_drv_video.h"
+#include "buffer.h"
 #include "context.h"
 #include "va_config.h"
 #include "surface.h"
@@ -33,6 +34,7 @@
 
 #include <assert.h>
 
+#include <sys/mman.h>
 #include <sys/ioctl.h>
 
 #include <linux/videodev2.h>
@@ -44,6 +46,349 @@
  * format is set.
  */
 
+/*
+ * Input buffers start large enough for most frames, 2 bits per pixel for MPEG-2
+ * and 1 for MPEG-4, and are only grown for the frames that don't fit
+ */
+static unsigned int sunxi_cedrus_input_size(VAProfile profile, int width,
+		int height)
+{
+	unsigned int size = width * height / 4;
+
+	switch(profile) {
+		case VAProfileMPEG4Simple:
+		case VAProfileMPEG4AdvancedSimple:
+		case VAProfileMPEG4Main:
+			size /= 2;
+			break;
+		default:
+			break;
+	}
+
+	if (size < INPUT_BUFFER_MIN_SIZE)
+		size = INPUT_BUFFER_MIN_SIZE;
+
+	return (size + 4095) & ~4095;
+}
+
+static void sunxi_cedrus_unmap_input_bufs(object_context_p obj_context)
+{
+	int i;
+
+	for (i = 0; i < INPUT_BUFFERS_MAX; i++)
+		if (obj_context->input_slots[i].data)
+		{
+			munmap(obj_context->input_slots[i].data,
+					obj_context->input_slots[i].size);
+			obj_context->input_slots[i].data = NULL;
+			obj_context->input_slots[i].size = 0;
+		}
+}
+
+/*
+ * Creates the input buffers, of the size of the format unless size is larger,
+ * and maps them. No slot is left when that fails.
+ */
+static VAStatus sunxi_cedrus_create_input_bufs(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_context_p obj_context, unsigned int size)
+{
+	struct v4l2_create_buffers create_bufs;
+	struct v4l2_buffer buf;
+	struct v4l2_plane plane[1];
+	int i, ret;
+
+	memset (&create_bufs, 0, sizeof (struct v4l2_create_buffers));
+	create_bufs.count = driver_data->queue_depth;
+	create_bufs.memory = V4L2_MEMORY_MMAP;
+	create_bufs.format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	if (ioctl(driver_data->mem2mem_fd, VIDIOC_G_FMT, &create_bufs.format))
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+	/* Buffers may be larger than the size of the format */
+	if (create_bufs.format.fmt.pix_mp.plane_fmt[0].sizeimage < size)
+		create_bufs.format.fmt.pix_mp.plane_fmt[0].sizeimage = size;
+	ret = ioctl(driver_data->mem2mem_fd, VIDIOC_CREATE_BUFS, &create_bufs);
+
+	/* The driver may give fewer buffers than asked for */
+	obj_context->num_input_slots = 0;
+	if (ret || create_bufs.count < 1)
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+	obj_context->num_input_slots = create_bufs.count < INPUT_BUFFERS_MAX ?
+		create_bufs.count : INPUT_BUFFERS_MAX;
+
+	/* Slices are written straight into these mappings, frame after frame */
+	for (i = 0; i < obj_context->num_input_slots; i++)
+	{
+		struct sunxi_cedrus_input_slot *slot =
+			&obj_context->input_slots[i];
+
+		memset(plane, 0, sizeof(struct v4l2_plane));
+		memset(&(buf), 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		buf.length = 1;
+		buf.m.planes = plane;
+		slot->data = MAP_FAILED;
+		if (ioctl(driver_data->mem2mem_fd, VIDIOC_QUERYBUF, &buf) == 0)
+			slot->data = mmap(NULL, plane[0].length,
+					PROT_READ | PROT_WRITE, MAP_SHARED,
+					driver_data->mem2mem_fd,
+					plane[0].m.mem_offset);
+		if (slot->data == MAP_FAILED)
+		{
+			slot->data = NULL;
+			sunxi_cedrus_unmap_input_bufs(obj_context);
+			obj_context->num_input_slots = 0;
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+		}
+		slot->size = plane[0].length;
+
+		if (plane[0].length > driver_data->input_buf_size)
+			driver_data->input_buf_size = plane[0].length;
+	}
+
+	return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Moves the picture being built to the first slot when the recreated buffers
+ * are fewer than its slot number
+ */
+static void sunxi_cedrus_clamp_current_slot(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_context_p obj_context)
+{
+	int current = obj_context->current_slot;
+	struct sunxi_cedrus_input_slot *from, *to;
+	object_surface_p obj_surface;
+
+	if (current < obj_context->num_input_slots)
+		return;
+
+	from = &obj_context->input_slots[current];
+	to = &obj_context->input_slots[0];
+	to->state = from->state;
+	to->mpeg2_frame_hdr = from->mpeg2_frame_hdr;
+	to->mpeg4_frame_hdr = from->mpeg4_frame_hdr;
+	from->state = INPUT_SLOT_FREE;
+	obj_context->current_slot = 0;
+
+	/* vaBeginPicture may already have given that slot to the surface */
+	obj_surface = SURFACE(obj_context->current_render_target);
+	if (obj_surface && obj_surface->status == VASurfaceRendering &&
+	    obj_surface->input_buf_index == current)
+	{
+		obj_surface->input_buf_index = 0;
+		obj_surface->request = 1;
+	}
+}
+
+/* Destroys the stopped input buffers and creates size bytes large ones */
+static VAStatus sunxi_cedrus_recreate_input_bufs(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_context_p obj_context, unsigned int size)
+{
+	struct v4l2_requestbuffers reqbufs;
+
+	sunxi_cedrus_unmap_input_bufs(obj_context);
+	obj_context->num_input_slots = 0;
+
+	memset(&reqbufs, 0, sizeof(reqbufs));
+	reqbufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	reqbufs.memory = V4L2_MEMORY_MMAP;
+	reqbufs.count = 0;
+	if (ioctl(driver_data->mem2mem_fd, VIDIOC_REQBUFS, &reqbufs))
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	return sunxi_cedrus_create_input_bufs(driver_data, obj_context, size);
+}
+
+/*
+ * V4L2 buffers can't be resized, so when slice data doesn't fit, all the input
+ * buffers are recreated at least twice as large once the pictures decoded from
+ * them are done. The slice data already written for the picture being built is
+ * copied to its new buffer, which its Buffers are moved to. Buffers of the
+ * previous size are recreated when larger ones can't be, the error still being
+ * returned. The context can't decode anymore if even those fail.
+ */
+VAStatus sunxi_cedrus_grow_input_bufs(VADriverContextP ctx,
+		object_context_p obj_context, unsigned int size)
+{
+	INIT_DRIVER_DATA
+	enum v4l2_buf_type type;
+	struct sunxi_cedrus_input_slot *slot;
+	object_heap_iterator iter;
+	object_buffer_p obj_buffer;
+	unsigned int new_size, prev_size, old_size = 0;
+	void *old_data = NULL, *copy = NULL;
+	VAStatus ret;
+	int i;
+
+	/* The picture being built keeps its slot, it isn't queued yet */
+	for (i = 0; i < obj_context->num_input_slots; i++)
+		if (obj_context->input_slots[i].state == INPUT_SLOT_QUEUED)
+			sunxi_cedrus_SyncSurface(ctx,
+					obj_context->input_slots[i].surface);
+
+	prev_size = obj_context->input_slots[0].size;
+	new_size = prev_size ? prev_size : INPUT_BUFFER_MIN_SIZE;
+	while (new_size < size)
+		new_size *= 2;
+
+	slot = obj_context->current_slot >= 0 ?
+		&obj_context->input_slots[obj_context->current_slot] : NULL;
+	if (slot && slot->data)
+	{
+		old_data = slot->data;
+		old_size = slot->size;
+		copy = malloc(old_size);
+		if (NULL == copy)
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+		memcpy(copy, old_data, old_size);
+	}
+
+	/* The current buffers are still usable when the queue can't stop */
+	type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	if (ioctl(driver_data->mem2mem_fd, VIDIOC_STREAMOFF, &type))
+	{
+		free(copy);
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
+
+	ret = sunxi_cedrus_recreate_input_bufs(driver_data, obj_context,
+			new_size);
+	if (ret != VA_STATUS_SUCCESS && prev_size)
+		sunxi_cedrus_recreate_input_bufs(driver_data, obj_context,
+				prev_size);
+
+	/* Streaming restarts whatever buffers are left */
+	if (ioctl(driver_data->mem2mem_fd, VIDIOC_STREAMON, &type) &&
+	    ret == VA_STATUS_SUCCESS)
+		ret = VA_STATUS_ERROR_OPERATION_FAILED;
+
+	/* The queue was stopped, so no other picture is queued anymore */
+	for (i = 0; i < INPUT_BUFFERS_MAX; i++)
+		if (i != obj_context->current_slot)
+			obj_context->input_slots[i].state = INPUT_SLOT_FREE;
+
+	if (obj_context->num_input_slots == 0)
+	{
+		if (obj_context->current_slot >= 0)
+			obj_context->input_slots[obj_context->current_slot].state =
+				INPUT_SLOT_FREE;
+		obj_context->current_slot = -1;
+		slot = NULL;
+	}
+	else
+	{
+		sunxi_cedrus_clamp_current_slot(driver_data, obj_context);
+		slot = obj_context->current_slot >= 0 ?
+			&obj_context->input_slots[obj_context->current_slot] :
+			NULL;
+		if (slot && copy)
+			memcpy(slot->data, copy, old_size < slot->size ?
+					old_size : slot->size);
+	}
+	free(copy);
+
+	if (NULL == old_data)
+		return ret;
+
+	/* Buffers of the picture follow its slot, if any is left */
+	obj_buffer = (object_buffer_p) object_heap_first(&driver_data->buffer_heap, &iter);
+	while (obj_buffer)
+	{
+		if (obj_buffer->memory == BUFFER_MEMORY_CONTEXT &&
+		    obj_buffer->buffer_data == old_data)
+		{
+			obj_buffer->buffer_data = slot ? slot->data : NULL;
+			obj_buffer->input_buf_index = slot ?
+				obj_context->current_slot : -1;
+		}
+		obj_buffer = (object_buffer_p) object_heap_next(&driver_data->buffer_heap, &iter);
+	}
+
+	return ret;
+}
+
+/*
+ * Returns the slot of the picture being built, picking a free one for a new
+ * picture. When all of them are queued, the oldest picture is waited for.
+ * Returns -1 when the context has no input buffer left.
+ */
+int sunxi_cedrus_get_input_slot(VADriverContextP ctx,
+		object_context_p obj_context)
+{
+	struct sunxi_cedrus_input_slot *slot;
+	int i, index = 0, oldest = -1;
+
+	if (obj_context->current_slot >= 0)
+		return obj_context->current_slot;
+
+	if (obj_context->num_input_slots == 0)
+		return -1;
+
+	for (i = 0; i < obj_context->num_input_slots; i++)
+	{
+		/* Slots are used in turn, so that all of them are kept busy */
+		index = (obj_context->num_rendered_surfaces + i) %
+			obj_context->num_input_slots;
+		slot = &obj_context->input_slots[index];
+
+		if (slot->state == INPUT_SLOT_FREE)
+			break;
+		if (slot->state == INPUT_SLOT_QUEUED && (oldest < 0 ||
+		    slot->sequence < obj_context->input_slots[oldest].sequence))
+			oldest = index;
+	}
+
+	if (i == obj_context->num_input_slots)
+	{
+		assert(oldest >= 0);
+		index = oldest;
+		sunxi_cedrus_SyncSurface(ctx,
+				obj_context->input_slots[index].surface);
+	}
+
+	slot = &obj_context->input_slots[index];
+	slot->state = INPUT_SLOT_FILLING;
+	obj_context->current_slot = index;
+
+	return index;
+}
+
+/* Hands the slot of the picture being built to the decoder, or frees it */
+void sunxi_cedrus_queue_input_slot(object_context_p obj_context,
+		struct object_surface *obj_surface, int queued)
+{
+	struct sunxi_cedrus_input_slot *slot =
+		&obj_context->input_slots[obj_surface->input_buf_index];
+
+	slot->state = queued ? INPUT_SLOT_QUEUED : INPUT_SLOT_FREE;
+	slot->surface = obj_surface->base.id;
+	slot->sequence = obj_context->num_rendered_surfaces;
+	obj_context->current_slot = -1;
+}
+
+/* Frees the slot of a Surface once its picture is dequeued */
+void sunxi_cedrus_release_input_slot(VADriverContextP ctx,
+		struct object_surface *obj_surface)
+{
+	INIT_DRIVER_DATA
+	object_context_p obj_context = CONTEXT(obj_surface->context_id);
+	struct sunxi_cedrus_input_slot *slot;
+
+	/* The context may be gone already */
+	if (NULL == obj_context)
+		return;
+
+	slot = &obj_context->input_slots[obj_surface->input_buf_index];
+	if (slot->state == INPUT_SLOT_QUEUED &&
+	    slot->surface == obj_surface->base.id)
+		slot->state = INPUT_SLOT_FREE;
+}
+
 VAStatus sunxi_cedrus_CreateContext(VADriverContextP ctx, VAConfigID config_id,
 		int picture_width, int picture_height, int flag,
 		VASurfaceID *render_targets, int num_render_targets,
@@ -53,7 +398,6 @@ VAStatus sunxi_cedrus_CreateContext(VADriverContextP ctx, VAConfigID config_id,
 	VAStatus vaStatus = VA_STATUS_SUCCESS;
 	object_config_p obj_config;
 	int i;
-	struct v4l2_create_buffers create_bufs;
 	struct v4l2_format fmt;
 	enum v4l2_buf_type type;
 
@@ -81,6 +425,9 @@ VAStatus sunxi_cedrus_CreateContext(VADriverContextP ctx, VAConfigID config_id,
 	obj_context->num_render_targets = num_render_targets;
 	obj_context->render_targets = (VASurfaceID *) malloc(num_render_targets * sizeof(VASurfaceID));
 	obj_context->num_rendered_surfaces = 0;
+	memset(obj_context->input_slots, 0, sizeof(obj_context->input_slots));
+	obj_context->num_input_slots = 0;
+	obj_context->current_slot = -1;
 
 	if (obj_context->render_targets == NULL)
 	{
@@ -115,7 +462,8 @@ VAStatus sunxi_cedrus_CreateContext(VADriverContextP ctx, VAConfigID config_id,
 	fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
 	fmt.fmt.pix_mp.width = picture_width;
 	fmt.fmt.pix_mp.height = picture_height;
-	fmt.fmt.pix_mp.plane_fmt[0].sizeimage = INPUT_BUFFER_MAX_SIZE;
+	fmt.fmt.pix_mp.plane_fmt[0].sizeimage = sunxi_cedrus_input_size(
+			obj_config->profile, picture_width, picture_height);
 	switch(obj_config->profile) {
 		case VAProfileMPEG2Simple:
 		case VAProfileMPEG2Main:
@@ -135,16 +483,18 @@ VAStatus sunxi_cedrus_CreateContext(VADriverContextP ctx, VAConfigID config_id,
 	fmt.fmt.pix_mp.num_planes = 1;
 	assert(ioctl(driver_data->mem2mem_fd, VIDIOC_S_FMT, &fmt)==0);
 
-	memset (&create_bufs, 0, sizeof (struct v4l2_create_buffers));
-	create_bufs.count = INPUT_BUFFERS_NB;
-	create_bufs.memory = V4L2_MEMORY_MMAP;
-	create_bufs.format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-	assert(ioctl(driver_data->mem2mem_fd, VIDIOC_G_FMT, &create_bufs.format)==0);
-	assert(ioctl(driver_data->mem2mem_fd, VIDIOC_CREATE_BUFS, &create_bufs)==0);
+	vaStatus = sunxi_cedrus_create_input_bufs(driver_data, obj_context, 0);
+	if (vaStatus != VA_STATUS_SUCCESS)
+		return vaStatus;
 
 	type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
 	assert(ioctl(driver_data->mem2mem_fd, VIDIOC_STREAMON, &type)==0);
 
+	/* Capture buffers must exist before streaming */
+	vaStatus = sunxi_cedrus_wait_capture_bufs(driver_data);
+	if (vaStatus != VA_STATUS_SUCCESS)
+		return vaStatus;
+
 	type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
 	assert(ioctl(driver_data->mem2mem_fd, VIDIOC_STREAMON, &type)==0);
 
@@ -157,6 +507,8 @@ VAStatus sunxi_cedrus_DestroyContext(VADriverContextP ctx, VAContextID context)
 	object_context_p obj_context = CONTEXT(context);
 	assert(obj_context);
 
+	sunxi_cedrus_unmap_input_bufs(obj_context);
+
 	obj_context->context_id = -1;
 	obj_context->config_id = -1;
 	obj_context->picture_width = 0;
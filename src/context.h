@@ -32,13 +32,38 @@
 
 /* We can't dynamically call VIDIOC_REQBUFS for every MPEG slice we create.
  * Indeed, the queue might be busy processing a previous buffer, so we need to
- * pre-allocate a set of buffers with a max size */
-#define INPUT_BUFFER_MAX_SIZE		131072
+ * pre-allocate a set of buffers, sized from the resolution and grown when a
+ * frame doesn't fit */
+#define INPUT_BUFFER_MIN_SIZE		32768
+/* Default and largest number of pictures queued at once */
 #define INPUT_BUFFERS_NB		4
+#define INPUT_BUFFERS_MAX		16
+
+/* State of an input buffer */
+#define INPUT_SLOT_FREE			0
+#define INPUT_SLOT_FILLING		1
+#define INPUT_SLOT_QUEUED		2
 
 #define CONTEXT(id) ((object_context_p) object_heap_lookup(&driver_data->context_heap, id))
 #define CONTEXT_ID_OFFSET		0x02000000
 
+struct object_surface;
+
+/* Input buffer and frame header of a picture, owned until it is synced */
+struct sunxi_cedrus_input_slot {
+	int state;
+	/* Surface decoded from the slot, while queued */
+	VASurfaceID surface;
+	/* Order the slot was queued in, the oldest one is waited for first */
+	uint32_t sequence;
+	/* Mapping of the buffer */
+	void *data;
+	unsigned int size;
+
+	struct v4l2_ctrl_mpeg2_frame_hdr mpeg2_frame_hdr;
+	struct v4l2_ctrl_mpeg4_frame_hdr mpeg4_frame_hdr;
+};
+
 struct object_context {
 	struct object_base base;
 	VAContextID context_id;
@@ -50,9 +75,11 @@ struct object_context {
 	int flags;
 	VASurfaceID *render_targets;
 	uint32_t num_rendered_surfaces;
-
-	struct v4l2_ctrl_mpeg2_frame_hdr mpeg2_frame_hdr;
-	struct v4l2_ctrl_mpeg4_frame_hdr mpeg4_frame_hdr;
+	/* Input buffers, mapped for the lifetime of the context */
+	struct sunxi_cedrus_input_slot input_slots[INPUT_BUFFERS_MAX];
+	int num_input_slots;
+	/* Slot of the picture being built, -1 when none */
+	int current_slot;
 };
 
 typedef struct object_context *object_context_p;
@@ -62,6 +89,18 @@ VAStatus sunxi_cedrus_CreateContext(VADriverContextP ctx, VAConfigID config_id,
 		VASurfaceID *render_targets, int num_render_targets,
 		VAContextID *context);
 
+VAStatus sunxi_cedrus_grow_input_bufs(VADriverContextP ctx,
+		object_context_p obj_context, unsigned int size);
+
+int sunxi_cedrus_get_input_slot(VADriverContextP ctx,
+		object_context_p obj_context);
+
+void sunxi_cedrus_queue_input_slot(object_context_p obj_context,
+		struct object_surface *obj_surface, int queued);
+
+void sunxi_cedrus_release_input_slot(VADriverContextP ctx,
+		struct object_surface *obj_surface);
+
 VAStatus sunxi_cedrus_DestroyContext(VADriverContextP ctx, VAContextID context);
 
 #endif /* _CONTEXT_H_ */
@@ -0,0 +1,643 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "sunxi_cedrus_drv_video.h"
+#include "convert.h"
+#include "surface.h"
+#include "worker.h"
+
+#include "tiled_rgb.h"
+#include "tiled_rotate.h"
+#include "tiled_scale.h"
+#include "tiled_yuv.h"
+
+#include <string.h>
+
+/*
+ * Conversion of the tiled frames decoded in a Surface to the planes of an
+ * Image. The region to convert is cut in bands of whole lines of tiles which
+ * are converted in parallel by the driver's workers, luma and chroma bands
+ * being queued together. Only the tiles intersecting the region are read.
+ *
+ * The interleaved chroma plane is either copied as is (NV12) or split in two
+ * planes (I420 and YV12) in the same pass, or skipped (Y800), in which case it
+ * doesn't even need to be mapped. RGB images are produced from both tiled
+ * planes at once, bands being cut in the luma plane only.
+ *
+ * Regions can also be scaled while they are converted, bands are then cut in
+ * the lines of the image rather than in the lines of tiles. YUV images can be
+ * rotated and mirrored in the same pass, RGB images never are.
+ *
+ * In incremental mode, only the tiles whose signature changed since the
+ * previous frame are converted, the Image still holding that frame.
+ */
+
+#define MAX_BANDS			(2 * SUNXI_CEDRUS_MAX_WORKERS)
+
+struct sunxi_cedrus_band {
+	struct sunxi_cedrus_job job;
+	sunxi_cedrus_job_func convert;
+	char *src;
+	unsigned int src_width;
+	unsigned int x;
+	unsigned int y;
+	char *dst;
+	char *dst2;
+	unsigned int pitch;
+	unsigned int width;
+	unsigned int height;
+	/* Only used by RGB bands, src is then the luma plane */
+	char *chroma;
+	enum tiled_rgb_format rgb_format;
+	const struct tiled_rgb_matrix *matrix;
+};
+
+static void sunxi_cedrus_band_to_planar(void *arg)
+{
+	struct sunxi_cedrus_band *band = arg;
+
+	tiled_to_planar_region(band->src, band->src_width, band->x, band->y,
+			band->dst, band->pitch, band->width, band->height);
+}
+
+static void sunxi_cedrus_band_deinterleave_to_planar(void *arg)
+{
+	struct sunxi_cedrus_band *band = arg;
+
+	tiled_deinterleave_to_planar_region(band->src, band->src_width,
+			band->x, band->y, band->dst, band->dst2, band->pitch,
+			band->width, band->height);
+}
+
+static void sunxi_cedrus_band_to_rgb(void *arg)
+{
+	struct sunxi_cedrus_band *band = arg;
+
+	tiled_to_rgb_region(band->src, band->chroma, band->src_width, band->x,
+			band->y, band->dst, band->pitch, band->width,
+			band->height, band->rgb_format, band->matrix);
+}
+
+/*
+ * Cuts the region of a tiled plane in at most num_bands bands, returns the
+ * number of bands actually used. dst2 is only used by deinterleaving bands.
+ */
+static int sunxi_cedrus_split_plane(struct sunxi_cedrus_band *bands,
+		int num_bands, sunxi_cedrus_job_func convert, char *src,
+		unsigned int src_width, unsigned int x, unsigned int y,
+		char *dst, char *dst2, unsigned int pitch, unsigned int width,
+		unsigned int height)
+{
+	unsigned int first = y / TILE_SIZE;
+	unsigned int last = (y + height - 1) / TILE_SIZE;
+	unsigned int lines_per_band = (last - first + num_bands) / num_bands;
+	unsigned int line, start, end;
+	int i;
+
+	if (width == 0 || height == 0)
+		return 0;
+
+	for (i = 0, line = first; line <= last; i++, line += lines_per_band)
+	{
+		start = line * TILE_SIZE;
+		if (start < y)
+			start = y;
+		end = (line + lines_per_band) * TILE_SIZE;
+		if (end > y + height)
+			end = y + height;
+
+		bands[i].convert = convert;
+		bands[i].src = src;
+		bands[i].src_width = src_width;
+		bands[i].x = x;
+		bands[i].y = start;
+		bands[i].dst = dst + (start - y) * pitch;
+		bands[i].dst2 = dst2 ? dst2 + (start - y) * pitch : NULL;
+		bands[i].pitch = pitch;
+		bands[i].width = width;
+		bands[i].height = end - start;
+	}
+
+	return i;
+}
+
+static void sunxi_cedrus_run_bands(struct sunxi_cedrus_workers *workers,
+		struct sunxi_cedrus_band *bands, int num_bands)
+{
+	int i;
+
+	if (num_bands == 0)
+		return;
+
+	/* The last band is converted by the calling thread */
+	for (i = 0; i < num_bands - 1; i++)
+		sunxi_cedrus_workers_queue(workers, &bands[i].job,
+				bands[i].convert, &bands[i]);
+	bands[num_bands - 1].convert(&bands[num_bands - 1]);
+
+	for (i = 0; i < num_bands - 1; i++)
+		sunxi_cedrus_workers_wait(workers, &bands[i].job);
+}
+
+static void sunxi_cedrus_convert_rgb(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, int x, int y, unsigned int width,
+		unsigned int height, VAImage *image, char *data)
+{
+	struct sunxi_cedrus_band bands[MAX_BANDS];
+	const struct tiled_rgb_matrix *matrix;
+	int num_bands, i;
+
+	/* Without any hint, HD content is assumed to be BT.709 */
+	if (driver_data->rgb_matrix == 709 || (driver_data->rgb_matrix == 0 &&
+	    obj_surface->height >= 720))
+		matrix = &tiled_rgb_bt709;
+	else
+		matrix = &tiled_rgb_bt601;
+
+	num_bands = sunxi_cedrus_split_plane(bands,
+			driver_data->workers.num_threads,
+			sunxi_cedrus_band_to_rgb,
+			driver_data->luma_bufs[obj_surface->output_buf_index],
+			obj_surface->width, x, y, data + image->offsets[0], NULL,
+			image->pitches[0], width, height);
+
+	for (i = 0; i < num_bands; i++)
+	{
+		bands[i].chroma =
+			driver_data->chroma_bufs[obj_surface->output_buf_index];
+		bands[i].rgb_format = image->format.fourcc == VA_FOURCC_RGB565 ?
+			TILED_RGB_RGB565 : TILED_RGB_BGRA;
+		bands[i].matrix = matrix;
+	}
+
+	sunxi_cedrus_run_bands(&driver_data->workers, bands, num_bands);
+}
+
+/* Bands of lines of a scaled or rotated plane */
+struct sunxi_cedrus_lines_band {
+	struct sunxi_cedrus_job job;
+	const struct tiled_scale *scale;
+	const struct tiled_rotate *rotate;
+	unsigned int first;
+	unsigned int last;
+};
+
+static void sunxi_cedrus_band_lines(void *arg)
+{
+	struct sunxi_cedrus_lines_band *band = arg;
+
+	if (band->scale)
+		tiled_scale_lines(band->scale, band->first, band->last);
+	else
+		tiled_rotate_lines(band->rotate, band->first, band->last);
+}
+
+/* Bands are made of a multiple of align lines */
+static int sunxi_cedrus_split_lines(struct sunxi_cedrus_lines_band *bands,
+		int num_bands, unsigned int lines, unsigned int align,
+		const struct tiled_scale *scale,
+		const struct tiled_rotate *rotate)
+{
+	unsigned int lines_per_band = (lines + num_bands - 1) / num_bands;
+	unsigned int line;
+	int i;
+
+	lines_per_band = (lines_per_band + align - 1) / align * align;
+
+	for (i = 0, line = 0; line < lines; i++, line += lines_per_band)
+	{
+		bands[i].scale = scale;
+		bands[i].rotate = rotate;
+		bands[i].first = line;
+		bands[i].last = line + lines_per_band;
+		if (bands[i].last > lines)
+			bands[i].last = lines;
+	}
+
+	return i;
+}
+
+static void sunxi_cedrus_run_lines_bands(struct sunxi_cedrus_workers *workers,
+		struct sunxi_cedrus_lines_band *bands, int num_bands)
+{
+	int i;
+
+	/* The last band is handled by the calling thread */
+	for (i = 0; i < num_bands - 1; i++)
+		sunxi_cedrus_workers_queue(workers, &bands[i].job,
+				sunxi_cedrus_band_lines, &bands[i]);
+	sunxi_cedrus_band_lines(&bands[num_bands - 1]);
+
+	for (i = 0; i < num_bands - 1; i++)
+		sunxi_cedrus_workers_wait(workers, &bands[i].job);
+}
+
+/*
+ * Computes the chroma samples, pairs of bytes covering 2x2 pixels, of a region
+ * of the surface
+ */
+static void sunxi_cedrus_chroma_region(object_surface_p obj_surface,
+		int x, int y, unsigned int width, unsigned int height,
+		unsigned int *chroma_x, unsigned int *chroma_y,
+		unsigned int *chroma_width, unsigned int *chroma_height)
+{
+	unsigned int end;
+
+	*chroma_x = x / 2;
+	*chroma_y = y / 2;
+	end = (x + width + 1) / 2;
+	if (end > (obj_surface->width + 1) / 2)
+		end = (obj_surface->width + 1) / 2;
+	*chroma_width = end - *chroma_x;
+	end = (y + height + 1) / 2;
+	if (end > (obj_surface->height + 1) / 2)
+		end = (obj_surface->height + 1) / 2;
+	*chroma_height = end - *chroma_y;
+}
+
+/* Chroma components are interleaved in dst1 when dst2 is NULL */
+static void sunxi_cedrus_chroma_planes(VAImage *image, char *data,
+		char **dst1, char **dst2)
+{
+	switch (image->format.fourcc) {
+		case VA_FOURCC_I420:
+			*dst1 = data + image->offsets[1];
+			*dst2 = data + image->offsets[2];
+			break;
+		case VA_FOURCC_YV12:
+			*dst1 = data + image->offsets[2];
+			*dst2 = data + image->offsets[1];
+			break;
+		default:
+			*dst1 = data + image->offsets[1];
+			*dst2 = NULL;
+			break;
+	}
+}
+
+void sunxi_cedrus_scale_surface(struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, int x, int y, unsigned int width,
+		unsigned int height, unsigned int dst_width,
+		unsigned int dst_height, VAImage *image, char *data)
+{
+	struct sunxi_cedrus_lines_band bands[MAX_BANDS];
+	struct tiled_scale luma, chroma;
+	int num_threads = driver_data->workers.num_threads;
+	char *dst1, *dst2;
+	int num_bands;
+
+	luma.src = driver_data->luma_bufs[obj_surface->output_buf_index];
+	luma.src_width = obj_surface->width;
+	luma.x = x;
+	luma.y = y;
+	luma.width = width;
+	luma.height = height;
+	luma.components = 1;
+	luma.dst1 = data + image->offsets[0];
+	luma.dst2 = NULL;
+	luma.dst_pitch = image->pitches[0];
+	luma.dst_width = dst_width;
+	luma.dst_height = dst_height;
+
+	chroma.src = driver_data->chroma_bufs[obj_surface->output_buf_index];
+	chroma.src_width = obj_surface->width;
+	sunxi_cedrus_chroma_region(obj_surface, x, y, width, height,
+			&chroma.x, &chroma.y, &chroma.width, &chroma.height);
+	chroma.components = 2;
+	sunxi_cedrus_chroma_planes(image, data, &dst1, &dst2);
+	chroma.dst1 = dst1;
+	chroma.dst2 = dst2;
+	chroma.dst_pitch = image->pitches[1];
+	chroma.dst_width = (dst_width + 1) / 2;
+	chroma.dst_height = (dst_height + 1) / 2;
+
+	num_bands = sunxi_cedrus_split_lines(bands, num_threads, dst_height, 1,
+			&luma, NULL);
+	if (image->format.fourcc != VA_FOURCC_Y800)
+		num_bands += sunxi_cedrus_split_lines(bands + num_bands,
+				num_threads, chroma.dst_height, 1, &chroma,
+				NULL);
+
+	sunxi_cedrus_run_lines_bands(&driver_data->workers, bands, num_bands);
+}
+
+/* Bands are cut in lines of tiles of the source */
+static void sunxi_cedrus_rotate_surface(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, int x, int y, unsigned int width,
+		unsigned int height, VAImage *image, char *data,
+		unsigned int rotation, unsigned int mirror)
+{
+	struct sunxi_cedrus_lines_band bands[MAX_BANDS];
+	struct tiled_rotate luma, chroma;
+	int num_threads = driver_data->workers.num_threads;
+	char *dst1, *dst2;
+	int num_bands;
+
+	luma.src = driver_data->luma_bufs[obj_surface->output_buf_index];
+	luma.src_width = obj_surface->width;
+	luma.x = x;
+	luma.y = y;
+	luma.width = width;
+	luma.height = height;
+	luma.components = 1;
+	luma.dst1 = data + image->offsets[0];
+	luma.dst2 = NULL;
+	luma.dst_pitch = image->pitches[0];
+	luma.rotation = rotation;
+	luma.mirror = mirror;
+
+	chroma = luma;
+	chroma.src = driver_data->chroma_bufs[obj_surface->output_buf_index];
+	sunxi_cedrus_chroma_region(obj_surface, x, y, width, height,
+			&chroma.x, &chroma.y, &chroma.width, &chroma.height);
+	chroma.components = 2;
+	sunxi_cedrus_chroma_planes(image, data, &dst1, &dst2);
+	chroma.dst1 = dst1;
+	chroma.dst2 = dst2;
+	chroma.dst_pitch = image->pitches[1];
+
+	num_bands = sunxi_cedrus_split_lines(bands, num_threads, height,
+			TILE_SIZE, NULL, &luma);
+	if (image->format.fourcc != VA_FOURCC_Y800)
+		num_bands += sunxi_cedrus_split_lines(bands + num_bands,
+				num_threads, chroma.height, TILE_SIZE, NULL,
+				&chroma);
+
+	sunxi_cedrus_run_lines_bands(&driver_data->workers, bands, num_bands);
+}
+
+void sunxi_cedrus_convert_surface(struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, int x, int y, unsigned int width,
+		unsigned int height, VAImage *image, char *data,
+		unsigned int rotation, unsigned int mirror)
+{
+	struct sunxi_cedrus_band bands[MAX_BANDS];
+	int num_threads = driver_data->workers.num_threads;
+	char *chroma = driver_data->chroma_bufs[obj_surface->output_buf_index];
+	unsigned int chroma_x, chroma_y, chroma_width, chroma_height;
+	int num_bands;
+
+	switch (image->format.fourcc) {
+		case VA_FOURCC_BGRA:
+		case VA_FOURCC_BGRX:
+		case VA_FOURCC_RGB565:
+			sunxi_cedrus_convert_rgb(driver_data, obj_surface, x, y,
+					width, height, image, data);
+			return;
+	}
+
+	if (rotation != TILED_ROTATE_0 || mirror)
+	{
+		sunxi_cedrus_rotate_surface(driver_data, obj_surface, x, y,
+				width, height, image, data, rotation, mirror);
+		return;
+	}
+
+	num_bands = sunxi_cedrus_split_plane(bands, num_threads,
+			sunxi_cedrus_band_to_planar,
+			driver_data->luma_bufs[obj_surface->output_buf_index],
+			obj_surface->width, x, y, data + image->offsets[0], NULL,
+			image->pitches[0], width, height);
+
+	/* Interleaved chroma samples can't be split, offsets are in bytes */
+	sunxi_cedrus_chroma_region(obj_surface, x, y, width, height,
+			&chroma_x, &chroma_y, &chroma_width, &chroma_height);
+	/* Odd regions may cover one more chroma line than the Image holds */
+	if (chroma_width > (image->width + 1) / 2)
+		chroma_width = (image->width + 1) / 2;
+	if (chroma_height > (image->height + 1) / 2)
+		chroma_height = (image->height + 1) / 2;
+
+	switch (image->format.fourcc) {
+		case VA_FOURCC_Y800:
+			/* Grayscale images don't read the chroma plane at all */
+			break;
+		case VA_FOURCC_NV12:
+			num_bands += sunxi_cedrus_split_plane(bands + num_bands,
+					num_threads, sunxi_cedrus_band_to_planar,
+					chroma, obj_surface->width, chroma_x * 2,
+					chroma_y,
+					data + image->offsets[1], NULL,
+					image->pitches[1], chroma_width * 2,
+					chroma_height);
+			break;
+		case VA_FOURCC_I420:
+			num_bands += sunxi_cedrus_split_plane(bands + num_bands,
+					num_threads,
+					sunxi_cedrus_band_deinterleave_to_planar,
+					chroma, obj_surface->width, chroma_x * 2,
+					chroma_y,
+					data + image->offsets[1],
+					data + image->offsets[2],
+					image->pitches[1], chroma_width * 2,
+					chroma_height);
+			break;
+		case VA_FOURCC_YV12:
+			num_bands += sunxi_cedrus_split_plane(bands + num_bands,
+					num_threads,
+					sunxi_cedrus_band_deinterleave_to_planar,
+					chroma, obj_surface->width, chroma_x * 2,
+					chroma_y,
+					data + image->offsets[2],
+					data + image->offsets[1],
+					image->pitches[1], chroma_width * 2,
+					chroma_height);
+			break;
+	}
+
+	sunxi_cedrus_run_bands(&driver_data->workers, bands, num_bands);
+}
+
+struct sunxi_cedrus_tiles_band {
+	struct sunxi_cedrus_job job;
+	object_surface_p surface;
+	char *luma;
+	char *chroma;
+	VAImage *image;
+	char *data;
+	uint64_t *signatures;
+	int full;
+	unsigned char *bitmap;
+	unsigned int first;
+	unsigned int last;
+	unsigned int converted;
+};
+
+/* Return 1 when the tile changed since its signature was last stored */
+static inline int sunxi_cedrus_tile_changed(const char *tile,
+		uint64_t *signature, int full)
+{
+	uint64_t new_signature = tiled_signature(tile);
+
+	if (!full && new_signature == *signature)
+		return 0;
+
+	*signature = new_signature;
+	return 1;
+}
+
+static inline void sunxi_cedrus_tile_mark(unsigned char *bitmap,
+		unsigned int bitmap_pitch, unsigned int tx, unsigned int ty)
+{
+	bitmap[ty * bitmap_pitch + tx / 8] |= 1 << (tx % 8);
+}
+
+/*
+ * Handles the lines of chroma tiles first to last - 1 and the two lines of
+ * luma tiles sharing each of them
+ */
+static void sunxi_cedrus_band_tiles(void *arg)
+{
+	struct sunxi_cedrus_tiles_band *band = arg;
+	unsigned int width = band->surface->width;
+	unsigned int height = band->surface->height;
+	unsigned int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	unsigned int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+	unsigned int chroma_tiles_y = (height / 2 + TILE_SIZE - 1) / TILE_SIZE;
+	unsigned int bitmap_pitch = (tiles_x + 7) / 8;
+	uint64_t *chroma_signatures = band->signatures + tiles_x * tiles_y;
+	unsigned int last_line = 2 * band->last > tiles_y ?
+			tiles_y : 2 * band->last;
+	unsigned int tx, ty, cty, w, h;
+
+	memset(band->bitmap + 2 * band->first * bitmap_pitch, 0,
+			(last_line - 2 * band->first) * bitmap_pitch);
+
+	for (cty = band->first; cty < band->last; cty++)
+	{
+		for (ty = 2 * cty; ty < 2 * cty + 2 && ty < tiles_y; ty++)
+		{
+			h = height - ty * TILE_SIZE;
+			if (h > TILE_SIZE)
+				h = TILE_SIZE;
+
+			for (tx = 0; tx < tiles_x; tx++)
+			{
+				if (!sunxi_cedrus_tile_changed(band->luma +
+						ty * TILE_LINE_SIZE(width) +
+						tx * TILE_SIZE * TILE_SIZE,
+						&band->signatures[ty * tiles_x + tx],
+						band->full))
+					continue;
+
+				w = width - tx * TILE_SIZE;
+				if (w > TILE_SIZE)
+					w = TILE_SIZE;
+				tiled_to_planar_region(band->luma, width,
+						tx * TILE_SIZE, ty * TILE_SIZE,
+						band->data + band->image->offsets[0] +
+						ty * TILE_SIZE * band->image->pitches[0] +
+						tx * TILE_SIZE,
+						band->image->pitches[0], w, h);
+				sunxi_cedrus_tile_mark(band->bitmap,
+						bitmap_pitch, tx, ty);
+				band->converted++;
+			}
+		}
+
+		if (cty >= chroma_tiles_y)
+			continue;
+
+		h = height / 2 - cty * TILE_SIZE;
+		if (h > TILE_SIZE)
+			h = TILE_SIZE;
+
+		for (tx = 0; tx < tiles_x; tx++)
+		{
+			if (!sunxi_cedrus_tile_changed(band->chroma +
+					cty * TILE_LINE_SIZE(width) +
+					tx * TILE_SIZE * TILE_SIZE,
+					&chroma_signatures[cty * tiles_x + tx],
+					band->full))
+				continue;
+
+			w = width - tx * TILE_SIZE;
+			if (w > TILE_SIZE)
+				w = TILE_SIZE;
+			tiled_to_planar_region(band->chroma, width,
+					tx * TILE_SIZE, cty * TILE_SIZE,
+					band->data + band->image->offsets[1] +
+					cty * TILE_SIZE * band->image->pitches[1] +
+					tx * TILE_SIZE,
+					band->image->pitches[1], w, h);
+
+			/* A chroma tile covers two luma tiles vertically */
+			for (ty = 2 * cty; ty < 2 * cty + 2 && ty < tiles_y; ty++)
+				sunxi_cedrus_tile_mark(band->bitmap,
+						bitmap_pitch, tx, ty);
+			band->converted++;
+		}
+	}
+}
+
+unsigned int sunxi_cedrus_convert_surface_tiles(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, VAImage *image, char *data,
+		uint64_t *signatures, int full, unsigned char *bitmap)
+{
+	struct sunxi_cedrus_tiles_band bands[MAX_BANDS];
+	unsigned int tiles_y = (obj_surface->height + TILE_SIZE - 1) / TILE_SIZE;
+	unsigned int lines = (tiles_y + 1) / 2;
+	unsigned int lines_per_band, line, converted = 0;
+	int num_bands = driver_data->workers.num_threads;
+	int i;
+
+	lines_per_band = (lines + num_bands - 1) / num_bands;
+	for (i = 0, line = 0; line < lines; i++, line += lines_per_band)
+	{
+		bands[i].surface = obj_surface;
+		bands[i].luma =
+			driver_data->luma_bufs[obj_surface->output_buf_index];
+		bands[i].chroma =
+			driver_data->chroma_bufs[obj_surface->output_buf_index];
+		bands[i].image = image;
+		bands[i].data = data;
+		bands[i].signatures = signatures;
+		bands[i].full = full;
+		bands[i].bitmap = bitmap;
+		bands[i].first = line;
+		bands[i].last = line + lines_per_band > lines ?
+			lines : line + lines_per_band;
+		bands[i].converted = 0;
+	}
+	num_bands = i;
+
+	for (i = 0; i < num_bands - 1; i++)
+		sunxi_cedrus_workers_queue(&driver_data->workers, &bands[i].job,
+				sunxi_cedrus_band_tiles, &bands[i]);
+	sunxi_cedrus_band_tiles(&bands[num_bands - 1]);
+
+	for (i = 0; i < num_bands; i++)
+	{
+		if (i < num_bands - 1)
+			sunxi_cedrus_workers_wait(&driver_data->workers,
+					&bands[i].job);
+		converted += bands[i].converted;
+	}
+
+	return converted;
+}
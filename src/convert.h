@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _CONVERT_H_
+#define _CONVERT_H_
+
+#include <va/va_backend.h>
+
+#include <stdint.h>
+
+#include "sunxi_cedrus_drv_video.h"
+#include "image.h"
+#include "surface.h"
+
+/* Tiles of the sunxi pixel format are 32x32 bytes */
+#define TILE_SIZE			32
+#define TILE_LINE_SIZE(width)		((((width) + TILE_SIZE - 1) & ~(TILE_SIZE - 1)) * TILE_SIZE)
+
+/*
+ * Converts the width x height region at (x, y) of a surface to the planes of
+ * an image, starting at the top left corner of the image. YUV images are
+ * rotated and mirrored as given, the image must be sized for it.
+ */
+void sunxi_cedrus_convert_surface(struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, int x, int y, unsigned int width,
+		unsigned int height, VAImage *image, char *data,
+		unsigned int rotation, unsigned int mirror);
+
+/*
+ * Same as sunxi_cedrus_convert_surface but scales the region to
+ * dst_width x dst_height pixels, only for YUV images
+ */
+void sunxi_cedrus_scale_surface(struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, int x, int y, unsigned int width,
+		unsigned int height, unsigned int dst_width,
+		unsigned int dst_height, VAImage *image, char *data);
+
+/*
+ * Converts the tiles of the surface to an NV12 image whose content is the
+ * previous frame, skipping the tiles whose signature didn't change. All the
+ * tiles are converted when full is set. The signatures array holds one entry
+ * per luma tile followed by one per chroma tile. One bit per 32x32 pixels
+ * block, lines of bits starting on a byte, is set in bitmap for the blocks
+ * that were converted. Returns the number of tiles converted.
+ */
+unsigned int sunxi_cedrus_convert_surface_tiles(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, VAImage *image, char *data,
+		uint64_t *signatures, int full, unsigned char *bitmap);
+
+#endif /* _CONVERT_H_ */
@@ -24,60 +24,584 @@
  */
 
 #include "sunxi_cedrus_drv_video.h"
+#include "convert.h"
 #include "image.h"
 #include "surface.h"
 #include "buffer.h"
+#include "tiled_rotate.h"
 
 #include <assert.h>
-
-#include "tiled_yuv.h"
+#include <stdlib.h>
+#include <string.h>
 
 /*
  * An Image is a standard data structure containing rendered frames in a usable
- * pixel format. Here we only use NV12 buffers which are converted from sunxi's
- * proprietary tiled pixel format with tiled_yuv when deriving an Image from a
- * Surface.
+ * pixel format. Images are converted from sunxi's proprietary tiled pixel
+ * format with tiled_yuv (NV12, I420, YV12 and the luma only Y800) or tiled_rgb
+ * (BGRA, BGRX and RGB565), derived Images being NV12 unless configured
+ * otherwise. Optionally, derived Images can also directly expose the tiled
+ * planes of the Surface to the users able to handle them.
+ *
+ * Since a new Image is usually derived for every frame, destroyed Images are
+ * kept in a small pool together with their buffer and handed back by
+ * CreateImage when the format and size match.
+ *
+ * Optionally, decoded Surfaces are converted by the workers as soon as they
+ * are synced, so that DeriveImage usually finds its Image already converted.
+ *
+ * In incremental mode, the Image derived for the previous frame is kept aside
+ * by the pool once destroyed and derived again for the next frame, only its
+ * tiles that changed are converted. A bitmap of the 32x32 blocks converted
+ * follows the NV12 data in the buffer, at offset data_size.
+ *
+ * YUV Images are rotated and mirrored as set through the rotation display
+ * attribute, their width and height being swapped by quarter turns.
  */
 
+static const VAImageFormat sunxi_cedrus_image_formats[] = {
+	{ VA_FOURCC_NV12, VA_LSB_FIRST, 12 },
+	{ VA_FOURCC_I420, VA_LSB_FIRST, 12 },
+	{ VA_FOURCC_YV12, VA_LSB_FIRST, 12 },
+	{ VA_FOURCC_Y800, VA_LSB_FIRST, 8 },
+	{ VA_FOURCC_BGRA, VA_LSB_FIRST, 32, 32,
+		0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000 },
+	{ VA_FOURCC_BGRX, VA_LSB_FIRST, 32, 24,
+		0x00ff0000, 0x0000ff00, 0x000000ff, 0 },
+	{ VA_FOURCC_RGB565, VA_LSB_FIRST, 16, 16, 0xf800, 0x07e0, 0x001f, 0 },
+	{ VA_FOURCC_SUNXI_TILED_NV12, VA_LSB_FIRST, 12 },
+};
+
+#define SUNXI_CEDRUS_NB_IMAGE_FORMATS \
+	(sizeof(sunxi_cedrus_image_formats) / sizeof(sunxi_cedrus_image_formats[0]))
+
+static const VAImageFormat *sunxi_cedrus_find_image_format(unsigned int fourcc)
+{
+	int i;
+
+	for (i = 0; i < SUNXI_CEDRUS_NB_IMAGE_FORMATS; i++)
+		if (sunxi_cedrus_image_formats[i].fourcc == fourcc)
+			return &sunxi_cedrus_image_formats[i];
+
+	return NULL;
+}
+
 VAStatus sunxi_cedrus_QueryImageFormats(VADriverContextP ctx,
 		VAImageFormat *format_list, int *num_formats)
 {
-	format_list[0].fourcc = VA_FOURCC_NV12;
-	*num_formats = 1;
+	int i;
+
+	for (i = 0; i < SUNXI_CEDRUS_NB_IMAGE_FORMATS; i++)
+		format_list[i] = sunxi_cedrus_image_formats[i];
+	*num_formats = SUNXI_CEDRUS_NB_IMAGE_FORMATS;
 	return VA_STATUS_SUCCESS;
 }
 
-VAStatus sunxi_cedrus_CreateImage(VADriverContextP ctx, VAImageFormat *format,
+void sunxi_cedrus_image_pool_init(struct sunxi_cedrus_image_pool *pool)
+{
+	int i;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pool->num_images = 0;
+	pool->hits = 0;
+	pool->misses = 0;
+	for (i = 0; i < INCREMENTAL_SIZES; i++)
+		pool->reserved[i] = VA_INVALID_ID;
+}
+
+/* Must be called with the mutex held */
+static int sunxi_cedrus_image_pool_is_reserved(
+		struct sunxi_cedrus_image_pool *pool, VAImageID image_id)
+{
+	int i;
+
+	for (i = 0; i < INCREMENTAL_SIZES; i++)
+		if (pool->reserved[i] == image_id)
+			return 1;
+
+	return 0;
+}
+
+static void sunxi_cedrus_destroy_image(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_image_p obj_img)
+{
+	object_buffer_p obj_buffer = BUFFER(obj_img->buf);
+
+	if (obj_buffer)
+		sunxi_cedrus_destroy_buffer(driver_data, obj_buffer);
+	object_heap_free(&driver_data->image_heap, (object_base_p) obj_img);
+}
+
+/* Return 0 when a recycled image was found */
+static int sunxi_cedrus_image_pool_get(
+		struct sunxi_cedrus_image_pool *pool, unsigned int fourcc,
+		int width, int height, VAImage *image)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (i = 0; i < pool->num_images; i++)
+	{
+		if (!sunxi_cedrus_image_pool_is_reserved(pool,
+				pool->images[i].image_id) &&
+		    pool->images[i].format.fourcc == fourcc &&
+		    pool->images[i].width == width &&
+		    pool->images[i].height == height)
+		{
+			*image = pool->images[i];
+			memmove(&pool->images[i], &pool->images[i + 1],
+					(--pool->num_images - i) * sizeof(VAImage));
+			pool->hits++;
+			pthread_mutex_unlock(&pool->mutex);
+			return 0;
+		}
+	}
+	pool->misses++;
+	pthread_mutex_unlock(&pool->mutex);
+
+	return -1;
+}
+
+/*
+ * Return 0 when the image reserved for a size was given back with the
+ * requested size, otherwise it becomes a regular image of the pool
+ */
+static int sunxi_cedrus_image_pool_take_reserved(
+		struct sunxi_cedrus_image_pool *pool, unsigned int size,
 		int width, int height, VAImage *image)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (i = 0; i < pool->num_images; i++)
+	{
+		if (pool->images[i].image_id != pool->reserved[size])
+			continue;
+
+		if (pool->images[i].width == width &&
+		    pool->images[i].height == height)
+		{
+			*image = pool->images[i];
+			memmove(&pool->images[i], &pool->images[i + 1],
+					(--pool->num_images - i) * sizeof(VAImage));
+			pthread_mutex_unlock(&pool->mutex);
+			return 0;
+		}
+		break;
+	}
+	pool->reserved[size] = VA_INVALID_ID;
+	pthread_mutex_unlock(&pool->mutex);
+
+	return -1;
+}
+
+/* The image will be given back to the pool but not handed out again */
+static void sunxi_cedrus_image_pool_reserve(
+		struct sunxi_cedrus_image_pool *pool, unsigned int size,
+		VAImageID image_id)
+{
+	pthread_mutex_lock(&pool->mutex);
+	pool->reserved[size] = image_id;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/* Keeps an image for later use, the oldest one is evicted when full */
+static void sunxi_cedrus_image_pool_put(
+		struct sunxi_cedrus_driver_data *driver_data, VAImage *image)
+{
+	struct sunxi_cedrus_image_pool *pool = &driver_data->image_pool;
+	object_image_p evicted = NULL;
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->num_images == IMAGE_POOL_SIZE)
+	{
+		evicted = IMAGE(pool->images[0].image_id);
+		for (i = 0; i < INCREMENTAL_SIZES; i++)
+			if (pool->images[0].image_id == pool->reserved[i])
+				pool->reserved[i] = VA_INVALID_ID;
+		memmove(&pool->images[0], &pool->images[1],
+				--pool->num_images * sizeof(VAImage));
+	}
+	pool->images[pool->num_images++] = *image;
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (evicted)
+		sunxi_cedrus_destroy_image(driver_data, evicted);
+}
+
+void sunxi_cedrus_image_pool_flush(
+		struct sunxi_cedrus_driver_data *driver_data)
+{
+	struct sunxi_cedrus_image_pool *pool = &driver_data->image_pool;
+	VAImage images[IMAGE_POOL_SIZE];
+	int i, num_images;
+
+	pthread_mutex_lock(&pool->mutex);
+	num_images = pool->num_images;
+	memcpy(images, pool->images, num_images * sizeof(VAImage));
+	pool->num_images = 0;
+	for (i = 0; i < INCREMENTAL_SIZES; i++)
+		pool->reserved[i] = VA_INVALID_ID;
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < num_images; i++)
+		sunxi_cedrus_destroy_image(driver_data,
+				IMAGE(images[i].image_id));
+}
+
+void sunxi_cedrus_image_pool_destroy(
+		struct sunxi_cedrus_driver_data *driver_data)
+{
+	sunxi_cedrus_image_pool_flush(driver_data);
+	pthread_mutex_destroy(&driver_data->image_pool.mutex);
+}
+
+/* Return 0 when the format is supported */
+static int sunxi_cedrus_image_layout(VAImage *image)
+{
+	unsigned int pitch = (image->width+31)&~31;
+	unsigned int chroma_height = (image->height+1)/2;
+
+	switch (image->format.fourcc) {
+		case VA_FOURCC_NV12:
+			image->num_planes = 2;
+			image->pitches[0] = pitch;
+			image->pitches[1] = pitch;
+			image->offsets[0] = 0;
+			image->offsets[1] = pitch * image->height;
+			image->data_size = image->offsets[1] + pitch * chroma_height;
+			break;
+		case VA_FOURCC_I420:
+		case VA_FOURCC_YV12:
+			/* The second and third planes are swapped in YV12 */
+			image->num_planes = 3;
+			image->pitches[0] = pitch;
+			image->pitches[1] = pitch / 2;
+			image->pitches[2] = pitch / 2;
+			image->offsets[0] = 0;
+			image->offsets[1] = pitch * image->height;
+			image->offsets[2] = image->offsets[1] + pitch / 2 * chroma_height;
+			image->data_size = image->offsets[2] + pitch / 2 * chroma_height;
+			break;
+		case VA_FOURCC_Y800:
+			image->num_planes = 1;
+			image->pitches[0] = pitch;
+			image->offsets[0] = 0;
+			image->data_size = pitch * image->height;
+			break;
+		case VA_FOURCC_BGRA:
+		case VA_FOURCC_BGRX:
+		case VA_FOURCC_RGB565:
+			image->num_planes = 1;
+			image->pitches[0] = pitch * image->format.bits_per_pixel / 8;
+			image->offsets[0] = 0;
+			image->data_size = image->pitches[0] * image->height;
+			break;
+		case VA_FOURCC_SUNXI_TILED_NV12:
+			image->num_planes = 2;
+			image->pitches[0] = pitch;
+			image->pitches[1] = pitch;
+			image->offsets[0] = 0;
+			image->offsets[1] = TILE_LINE_SIZE(image->width) *
+				((image->height + TILE_SIZE - 1) / TILE_SIZE);
+			image->data_size = image->offsets[1] +
+				TILE_LINE_SIZE(image->width) *
+				((chroma_height + TILE_SIZE - 1) / TILE_SIZE);
+			break;
+		default:
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Allocates the Image and a buffer of size bytes for its laid out planes */
+static VAStatus sunxi_cedrus_alloc_image(VADriverContextP ctx, VAImage *image,
+		unsigned int size)
 {
 	INIT_DRIVER_DATA
-	int sizeY, sizeUV;
 	object_image_p obj_img;
 
+	image->image_id = object_heap_allocate(&driver_data->image_heap);
+	if (image->image_id == VA_INVALID_ID)
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+	obj_img = IMAGE(image->image_id);
+
+	if (sunxi_cedrus_CreateBuffer(ctx, 0, VAImageBufferType, size,
+	    1, NULL, &image->buf) != VA_STATUS_SUCCESS)
+	{
+		object_heap_free(&driver_data->image_heap, (object_base_p) obj_img);
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+	}
+	obj_img->buf = image->buf;
+	obj_img->image = *image;
+
+	return VA_STATUS_SUCCESS;
+}
+
+VAStatus sunxi_cedrus_CreateImage(VADriverContextP ctx, VAImageFormat *format,
+		int width, int height, VAImage *image)
+{
+	INIT_DRIVER_DATA
+
+	if (sunxi_cedrus_image_pool_get(&driver_data->image_pool,
+			format->fourcc, width, height, image) == 0)
+		return VA_STATUS_SUCCESS;
+
 	image->format = *format;
 	image->buf = VA_INVALID_ID;
 	image->width = width;
 	image->height = height;
 
-	sizeY    = image->width * image->height;
-	sizeUV   = ((image->width+1) * (image->height+1)/2);
+	if (sunxi_cedrus_image_layout(image))
+		return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
 
+	return sunxi_cedrus_alloc_image(ctx, image, image->data_size);
+}
+
+/* The Image's buffer is a window on the planes of the Surface */
+static VAStatus sunxi_cedrus_derive_tiled_image(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, VAImage *image)
+{
+	char *luma = driver_data->luma_bufs[obj_surface->output_buf_index];
+	char *chroma = driver_data->chroma_bufs[obj_surface->output_buf_index];
+	object_image_p obj_img;
+	object_buffer_p obj_buffer;
+
+	image->format = *sunxi_cedrus_find_image_format(VA_FOURCC_SUNXI_TILED_NV12);
+	image->width = obj_surface->width;
+	image->height = obj_surface->height;
+
+	/* Both planes were mapped contiguously by sunxi_cedrus_map_surface */
 	image->num_planes = 2;
 	image->pitches[0] = (image->width+31)&~31;
 	image->pitches[1] = (image->width+31)&~31;
 	image->offsets[0] = 0;
-	image->offsets[1] = sizeY;
-	image->data_size  = sizeY + sizeUV;
+	image->offsets[1] = chroma - luma;
+	image->data_size = image->offsets[1] + TILE_LINE_SIZE(image->width) *
+		((image->height / 2 + TILE_SIZE - 1) / TILE_SIZE);
 
 	image->image_id = object_heap_allocate(&driver_data->image_heap);
 	if (image->image_id == VA_INVALID_ID)
 		return VA_STATUS_ERROR_ALLOCATION_FAILED;
 	obj_img = IMAGE(image->image_id);
 
-	if (sunxi_cedrus_CreateBuffer(ctx, 0, VAImageBufferType, image->data_size,
-	    1, NULL, &image->buf) != VA_STATUS_SUCCESS)
+	image->buf = object_heap_allocate(&driver_data->buffer_heap);
+	obj_buffer = BUFFER(image->buf);
+	if (NULL == obj_buffer)
+	{
+		object_heap_free(&driver_data->image_heap, (object_base_p) obj_img);
 		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+	}
+
+	obj_buffer->buffer_data = luma;
+	obj_buffer->memory = BUFFER_MEMORY_SURFACE;
+	obj_buffer->type = VAImageBufferType;
+	obj_buffer->size = image->data_size;
+	obj_buffer->max_num_elements = 1;
+	obj_buffer->num_elements = 1;
 	obj_img->buf = image->buf;
+	obj_img->image = *image;
+
+	return VA_STATUS_SUCCESS;
+}
+
+/* Returns whether regions are rotated or mirrored into Images of that format */
+static int sunxi_cedrus_image_rotated(
+		struct sunxi_cedrus_driver_data *driver_data,
+		unsigned int fourcc)
+{
+	switch (fourcc) {
+		case VA_FOURCC_BGRA:
+		case VA_FOURCC_BGRX:
+		case VA_FOURCC_RGB565:
+			return 0;
+		default:
+			return driver_data->rotation != TILED_ROTATE_0 ||
+				driver_data->mirror;
+	}
+}
+
+/* Quarter turns swap the width and the height of the region */
+static int sunxi_cedrus_image_transposed(
+		struct sunxi_cedrus_driver_data *driver_data,
+		unsigned int fourcc)
+{
+	return sunxi_cedrus_image_rotated(driver_data, fourcc) &&
+		(driver_data->rotation == TILED_ROTATE_90 ||
+		 driver_data->rotation == TILED_ROTATE_270);
+}
+
+/* Creates an Image of the Surface's size in the format of derived Images */
+static VAStatus sunxi_cedrus_create_derived_image(VADriverContextP ctx,
+		object_surface_p obj_surface, VAImage *image)
+{
+	INIT_DRIVER_DATA
+	const VAImageFormat *format;
+
+	format = sunxi_cedrus_find_image_format(driver_data->derive_fourcc);
+	if (NULL == format ||
+	    format->fourcc == VA_FOURCC_SUNXI_TILED_NV12)
+		format = sunxi_cedrus_find_image_format(VA_FOURCC_NV12);
+
+	if (sunxi_cedrus_image_transposed(driver_data, format->fourcc))
+		return sunxi_cedrus_CreateImage(ctx, (VAImageFormat *) format,
+				obj_surface->height, obj_surface->width, image);
+
+	return sunxi_cedrus_CreateImage(ctx, (VAImageFormat *) format,
+			obj_surface->width, obj_surface->height, image);
+}
+
+static void sunxi_cedrus_prefetch_job(void *arg)
+{
+	struct sunxi_cedrus_prefetch *prefetch = arg;
+
+	sunxi_cedrus_convert_surface(prefetch->driver_data, prefetch->surface,
+			0, 0, prefetch->surface->width,
+			prefetch->surface->height, &prefetch->image,
+			prefetch->data, prefetch->rotation, prefetch->mirror);
+}
+
+void sunxi_cedrus_prefetch_image(VADriverContextP ctx,
+		object_surface_p obj_surface)
+{
+	INIT_DRIVER_DATA
+	struct sunxi_cedrus_prefetch *prefetch = &obj_surface->prefetch;
+	object_buffer_p obj_buffer;
+
+	if (!driver_data->prefetch || driver_data->derive_tiled)
+		return;
+
+	sunxi_cedrus_drop_prefetched_image(ctx, obj_surface);
+
+	if (sunxi_cedrus_map_surface(driver_data, obj_surface,
+	    driver_data->derive_fourcc != VA_FOURCC_Y800) != VA_STATUS_SUCCESS)
+		return;
+
+	if (sunxi_cedrus_create_derived_image(ctx, obj_surface,
+	    &prefetch->image) != VA_STATUS_SUCCESS)
+	{
+		prefetch->image.image_id = VA_INVALID_ID;
+		return;
+	}
+
+	obj_buffer = BUFFER(prefetch->image.buf);
+	assert(obj_buffer);
+
+	prefetch->driver_data = driver_data;
+	prefetch->surface = obj_surface;
+	prefetch->data = obj_buffer->buffer_data;
+	prefetch->rotation = driver_data->rotation;
+	prefetch->mirror = driver_data->mirror;
+	sunxi_cedrus_workers_queue(&driver_data->workers, &prefetch->job,
+			sunxi_cedrus_prefetch_job, prefetch);
+}
+
+/* Waits for the conversion and gives the Image back to the pool */
+void sunxi_cedrus_drop_prefetched_image(VADriverContextP ctx,
+		object_surface_p obj_surface)
+{
+	INIT_DRIVER_DATA
+	struct sunxi_cedrus_prefetch *prefetch = &obj_surface->prefetch;
+
+	if (prefetch->image.image_id == VA_INVALID_ID)
+		return;
+
+	sunxi_cedrus_workers_wait(&driver_data->workers, &prefetch->job);
+	sunxi_cedrus_DestroyImage(ctx, prefetch->image.image_id);
+	prefetch->image.image_id = VA_INVALID_ID;
+}
+
+/*
+ * Returns the index of the signatures kept for the size of the surface, the
+ * least recently added size is forgotten when a new one shows up
+ */
+static unsigned int sunxi_cedrus_incremental_size(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface)
+{
+	struct sunxi_cedrus_dirty_tiles *dirty_tiles = &driver_data->dirty_tiles;
+	struct sunxi_cedrus_tile_signatures *sizes = dirty_tiles->sizes;
+	unsigned int i;
+
+	for (i = 0; i < INCREMENTAL_SIZES; i++)
+		if (sizes[i].width == obj_surface->width &&
+		    sizes[i].height == obj_surface->height)
+			return i;
+
+	i = dirty_tiles->next;
+	dirty_tiles->next = (i + 1) % INCREMENTAL_SIZES;
+	sizes[i].width = obj_surface->width;
+	sizes[i].height = obj_surface->height;
+	/* The image converted for the previous size becomes a regular one */
+	sunxi_cedrus_image_pool_reserve(&driver_data->image_pool, i,
+			VA_INVALID_ID);
+
+	return i;
+}
+
+static VAStatus sunxi_cedrus_derive_incremental_image(VADriverContextP ctx,
+		object_surface_p obj_surface, VAImage *image)
+{
+	INIT_DRIVER_DATA
+	unsigned int size = sunxi_cedrus_incremental_size(driver_data,
+			obj_surface);
+	struct sunxi_cedrus_tile_signatures *dirty_tiles =
+			&driver_data->dirty_tiles.sizes[size];
+	unsigned int tiles_x = (obj_surface->width + TILE_SIZE - 1) / TILE_SIZE;
+	unsigned int tiles_y = (obj_surface->height + TILE_SIZE - 1) / TILE_SIZE;
+	unsigned int num_tiles = tiles_x * (tiles_y +
+			(obj_surface->height / 2 + TILE_SIZE - 1) / TILE_SIZE);
+	object_buffer_p obj_buffer;
+	VAStatus ret;
+	int full = 0;
+
+	/* The previous frame can only be updated once the user gave it back */
+	if (sunxi_cedrus_image_pool_take_reserved(&driver_data->image_pool,
+			size, obj_surface->width, obj_surface->height, image))
+	{
+		image->format = *sunxi_cedrus_find_image_format(VA_FOURCC_NV12);
+		image->buf = VA_INVALID_ID;
+		image->width = obj_surface->width;
+		image->height = obj_surface->height;
+		sunxi_cedrus_image_layout(image);
+
+		ret = sunxi_cedrus_alloc_image(ctx, image, image->data_size +
+				(tiles_x + 7) / 8 * tiles_y);
+		if (ret != VA_STATUS_SUCCESS)
+			return ret;
+		full = 1;
+	}
+
+	if (dirty_tiles->num_tiles != num_tiles)
+	{
+		free(dirty_tiles->signatures);
+		dirty_tiles->signatures = malloc(num_tiles * sizeof(uint64_t));
+		if (NULL == dirty_tiles->signatures)
+		{
+			dirty_tiles->num_tiles = 0;
+			sunxi_cedrus_DestroyImage(ctx, image->image_id);
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+		}
+		dirty_tiles->num_tiles = num_tiles;
+		full = 1;
+	}
+
+	obj_buffer = BUFFER(image->buf);
+	assert(obj_buffer);
+
+	driver_data->dirty_tiles.converted +=
+			sunxi_cedrus_convert_surface_tiles(driver_data,
+			obj_surface, image, obj_buffer->buffer_data,
+			dirty_tiles->signatures, full,
+			(unsigned char *) obj_buffer->buffer_data +
+			image->data_size);
+	driver_data->dirty_tiles.tiles += num_tiles;
+
+	sunxi_cedrus_image_pool_reserve(&driver_data->image_pool, size,
+			image->image_id);
 
 	return VA_STATUS_SUCCESS;
 }
@@ -87,15 +611,39 @@ VAStatus sunxi_cedrus_DeriveImage(VADriverContextP ctx, VASurfaceID surface,
 {
 	INIT_DRIVER_DATA
 	object_surface_p obj_surface;
-	VAImageFormat fmt;
 	object_buffer_p obj_buffer;
 	VAStatus ret;
 
 	obj_surface = SURFACE(surface);
-	fmt.fourcc = VA_FOURCC_NV12;
+	if (NULL == obj_surface)
+		return VA_STATUS_ERROR_INVALID_SURFACE;
 
-	ret = sunxi_cedrus_CreateImage(ctx, &fmt, obj_surface->width,
-			obj_surface->height, image);
+	ret = sunxi_cedrus_map_surface(driver_data, obj_surface,
+			driver_data->derive_tiled ||
+			driver_data->derive_fourcc != VA_FOURCC_Y800);
+	if (ret != VA_STATUS_SUCCESS)
+		return ret;
+
+	if (driver_data->derive_tiled)
+		return sunxi_cedrus_derive_tiled_image(driver_data, obj_surface,
+				image);
+
+	/* The Image now belongs to the user */
+	if (obj_surface->prefetch.image.image_id != VA_INVALID_ID)
+	{
+		sunxi_cedrus_workers_wait(&driver_data->workers,
+				&obj_surface->prefetch.job);
+		*image = obj_surface->prefetch.image;
+		obj_surface->prefetch.image.image_id = VA_INVALID_ID;
+		return VA_STATUS_SUCCESS;
+	}
+
+	if (driver_data->incremental &&
+	    driver_data->rotation == TILED_ROTATE_0 && !driver_data->mirror)
+		return sunxi_cedrus_derive_incremental_image(ctx, obj_surface,
+				image);
+
+	ret = sunxi_cedrus_create_derived_image(ctx, obj_surface, image);
 	if(ret != VA_STATUS_SUCCESS)
 		return ret;
 
@@ -104,8 +652,10 @@ VAStatus sunxi_cedrus_DeriveImage(VADriverContextP ctx, VASurfaceID surface,
 		return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
 	/* TODO: Use an appropriate DRM plane instead */
-	tiled_to_planar(driver_data->luma_bufs[obj_surface->output_buf_index], obj_buffer->buffer_data, image->pitches[0], image->width, image->height);
-	tiled_to_planar(driver_data->chroma_bufs[obj_surface->output_buf_index], obj_buffer->buffer_data + image->width*image->height, image->pitches[1], image->width, image->height/2);
+	sunxi_cedrus_convert_surface(driver_data, obj_surface, 0, 0,
+			obj_surface->width, obj_surface->height, image,
+			obj_buffer->buffer_data, driver_data->rotation,
+			driver_data->mirror);
 
 	return VA_STATUS_SUCCESS;
 }
@@ -114,11 +664,19 @@ VAStatus sunxi_cedrus_DestroyImage(VADriverContextP ctx, VAImageID image)
 {
 	INIT_DRIVER_DATA
 	object_image_p obj_img;
+	object_buffer_p obj_buffer;
 
 	obj_img = IMAGE(image);
-	assert(obj_img);
+	if (NULL == obj_img)
+		return VA_STATUS_ERROR_INVALID_IMAGE;
+
+	/* Images borrowing the planes of a surface aren't worth recycling */
+	obj_buffer = BUFFER(obj_img->buf);
+	if (obj_buffer && obj_buffer->memory != BUFFER_MEMORY_SURFACE)
+		sunxi_cedrus_image_pool_put(driver_data, &obj_img->image);
+	else
+		sunxi_cedrus_destroy_image(driver_data, obj_img);
 
-	sunxi_cedrus_DestroyBuffer(ctx, obj_img->buf);
 	return VA_STATUS_SUCCESS;
 }
 
@@ -126,10 +684,108 @@ VAStatus sunxi_cedrus_SetImagePalette(VADriverContextP ctx, VAImageID image,
 		unsigned char *palette)
 { return VA_STATUS_SUCCESS; }
 
+/*
+ * Converts a region of the Surface straight into an existing Image, scaling it
+ * down when the Image is smaller than the region. Rotated regions can't be
+ * scaled.
+ */
 VAStatus sunxi_cedrus_GetImage(VADriverContextP ctx, VASurfaceID surface,
 		int x, int y, unsigned int width, unsigned int height,
 		VAImageID image)
-{ return VA_STATUS_SUCCESS; }
+{
+	INIT_DRIVER_DATA
+	object_surface_p obj_surface;
+	object_image_p obj_img;
+	object_buffer_p obj_buffer;
+	unsigned int dst_width, dst_height;
+	int rotated;
+	VAStatus ret;
+
+	obj_surface = SURFACE(surface);
+	if (NULL == obj_surface)
+		return VA_STATUS_ERROR_INVALID_SURFACE;
+
+	obj_img = IMAGE(image);
+	if (NULL == obj_img)
+		return VA_STATUS_ERROR_INVALID_IMAGE;
+
+	obj_buffer = BUFFER(obj_img->buf);
+	if (NULL == obj_buffer)
+		return VA_STATUS_ERROR_INVALID_BUFFER;
+
+	switch (obj_img->image.format.fourcc) {
+		case VA_FOURCC_NV12:
+		case VA_FOURCC_I420:
+		case VA_FOURCC_YV12:
+		case VA_FOURCC_Y800:
+		case VA_FOURCC_BGRA:
+		case VA_FOURCC_BGRX:
+		case VA_FOURCC_RGB565:
+			break;
+		default:
+			return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+	}
+
+	if (x < 0 || y < 0 || width == 0 || height == 0 ||
+	    x + width > obj_surface->width || y + height > obj_surface->height)
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+	/* Rotated regions must fit in the Image, they are never scaled */
+	rotated = sunxi_cedrus_image_rotated(driver_data,
+			obj_img->image.format.fourcc);
+	if (sunxi_cedrus_image_transposed(driver_data,
+			obj_img->image.format.fourcc))
+	{
+		dst_width = height;
+		dst_height = width;
+	}
+	else
+	{
+		dst_width = width;
+		dst_height = height;
+	}
+	if (rotated && (dst_width > obj_img->image.width ||
+	    dst_height > obj_img->image.height))
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+	/* Regions larger than the Image are scaled down to fit in it */
+	if (dst_width > obj_img->image.width)
+		dst_width = obj_img->image.width;
+	if (dst_height > obj_img->image.height)
+		dst_height = obj_img->image.height;
+	if (!rotated && (dst_width != width || dst_height != height) &&
+	    obj_img->image.format.fourcc != VA_FOURCC_NV12 &&
+	    obj_img->image.format.fourcc != VA_FOURCC_I420 &&
+	    obj_img->image.format.fourcc != VA_FOURCC_YV12 &&
+	    obj_img->image.format.fourcc != VA_FOURCC_Y800)
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+	/* The device may still be writing the planes when the sync failed */
+	if (obj_surface->status == VASurfaceRendering)
+	{
+		ret = sunxi_cedrus_SyncSurface(ctx, surface);
+		if (ret != VA_STATUS_SUCCESS)
+			return ret;
+	}
+
+	/* Y800 images only read the luma plane */
+	ret = sunxi_cedrus_map_surface(driver_data, obj_surface,
+			obj_img->image.format.fourcc != VA_FOURCC_Y800);
+	if (ret != VA_STATUS_SUCCESS)
+		return ret;
+
+	if (!rotated && (dst_width != width || dst_height != height))
+		sunxi_cedrus_scale_surface(driver_data, obj_surface, x, y,
+				width, height, dst_width, dst_height,
+				&obj_img->image, obj_buffer->buffer_data);
+	else
+		sunxi_cedrus_convert_surface(driver_data, obj_surface, x, y,
+				width, height, &obj_img->image,
+				obj_buffer->buffer_data, driver_data->rotation,
+				driver_data->mirror);
+
+	return VA_STATUS_SUCCESS;
+}
 
 VAStatus sunxi_cedrus_PutImage(VADriverContextP ctx, VASurfaceID surface,
 		VAImageID image, int src_x, int src_y, unsigned int src_width,
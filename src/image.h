@@ -28,18 +28,106 @@
 
 #include <va/va_backend.h>
 
+#include <pthread.h>
+#include <stdint.h>
+
 #include "object_heap.h"
+#include "worker.h"
 
 #define IMAGE(id)   ((object_image_p)   object_heap_lookup(&driver_data->image_heap,   id))
 #define IMAGE_ID_OFFSET			0x10000000
 
+/*
+ * Private format exposing the planes as decoded by the VPU: NV12 cut in 32x32
+ * tiles, stored line of tiles after line of tiles. A line of tiles is
+ * pitch * 32 bytes long.
+ */
+#define VA_FOURCC_SUNXI_TILED_NV12	VA_FOURCC('S', 'T', '1', '2')
+
+#ifndef VA_FOURCC_Y800
+#define VA_FOURCC_Y800			VA_FOURCC('Y', '8', '0', '0')
+#endif
+
+#ifndef VA_FOURCC_RGB565
+#define VA_FOURCC_RGB565		VA_FOURCC('R', 'G', '1', '6')
+#endif
+
+/* Number of destroyed images kept around to be recycled */
+#define IMAGE_POOL_SIZE			4
+
+/* Number of picture sizes converted incrementally at the same time */
+#define INCREMENTAL_SIZES		2
+
 struct object_image {
 	struct object_base base;
 	VABufferID buf;
+	VAImage image;
 };
 
 typedef struct object_image *object_image_p;
 
+struct sunxi_cedrus_image_pool {
+	pthread_mutex_t mutex;
+	VAImage images[IMAGE_POOL_SIZE];
+	int num_images;
+	unsigned int hits;
+	unsigned int misses;
+	/*
+	 * Images holding the last incremental conversion of each size, never
+	 * handed out
+	 */
+	VAImageID reserved[INCREMENTAL_SIZES];
+};
+
+/*
+ * Signatures of the tiles of the last frame of a size converted in incremental
+ * mode, one per luma tile followed by one per chroma tile
+ */
+struct sunxi_cedrus_tile_signatures {
+	int width;
+	int height;
+	uint64_t *signatures;
+	unsigned int num_tiles;
+};
+
+struct sunxi_cedrus_dirty_tiles {
+	struct sunxi_cedrus_tile_signatures sizes[INCREMENTAL_SIZES];
+	/* Next size replaced when a new one shows up */
+	unsigned int next;
+	unsigned int tiles;
+	unsigned int converted;
+};
+
+struct sunxi_cedrus_driver_data;
+struct object_surface;
+
+/* Conversion of a decoded Surface started before the Image is derived */
+struct sunxi_cedrus_prefetch {
+	struct sunxi_cedrus_job job;
+	struct sunxi_cedrus_driver_data *driver_data;
+	struct object_surface *surface;
+	char *data;
+	VAImage image;
+	/* Orientation the Image was sized for */
+	unsigned int rotation;
+	unsigned int mirror;
+};
+
+void sunxi_cedrus_prefetch_image(VADriverContextP ctx,
+		struct object_surface *obj_surface);
+
+void sunxi_cedrus_drop_prefetched_image(VADriverContextP ctx,
+		struct object_surface *obj_surface);
+
+void sunxi_cedrus_image_pool_init(struct sunxi_cedrus_image_pool *pool);
+
+/* Destroys the images kept for recycling, the reserved ones included */
+void sunxi_cedrus_image_pool_flush(
+		struct sunxi_cedrus_driver_data *driver_data);
+
+void sunxi_cedrus_image_pool_destroy(
+		struct sunxi_cedrus_driver_data *driver_data);
+
 VAStatus sunxi_cedrus_QueryImageFormats(VADriverContextP ctx,
 		VAImageFormat *format_list, int *num_formats);
 
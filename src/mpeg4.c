@@ -29,7 +29,6 @@
 #include <assert.h>
 #include <string.h>
 
-#include <sys/mman.h>
 #include <sys/ioctl.h>
 
 #include <linux/videodev2.h>
@@ -43,29 +42,12 @@ VAStatus sunxi_cedrus_render_mpeg4_slice_data(VADriverContextP ctx,
 		object_context_p obj_context, object_surface_p obj_surface,
 		object_buffer_p obj_buffer)
 {
-	INIT_DRIVER_DATA
 	VAStatus vaStatus = VA_STATUS_SUCCESS;
-	struct v4l2_buffer buf;
-	struct v4l2_plane plane[1];
-
-	memset(plane, 0, sizeof(struct v4l2_plane));
-
-	/* Query */
-	memset(&(buf), 0, sizeof(buf));
-	buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-	buf.memory = V4L2_MEMORY_MMAP;
-	buf.index = obj_surface->input_buf_index;
-	buf.length = 1;
-	buf.m.planes = plane;
-
-	assert(ioctl(driver_data->mem2mem_fd, VIDIOC_QUERYBUF, &buf)==0);
 
-	/* Populate frame */
-	char *src_buf = mmap(NULL, obj_buffer->size,
-			PROT_READ | PROT_WRITE, MAP_SHARED,
-			driver_data->mem2mem_fd, buf.m.planes[0].m.mem_offset);
-	assert(src_buf != MAP_FAILED);
-	memcpy(src_buf, obj_buffer->buffer_data, obj_buffer->size);
+	/*
+	 * The data was written in place, its position in the input buffer
+	 * comes from the slice parameters
+	 */
 
 	return vaStatus;
 }
@@ -76,47 +58,49 @@ VAStatus sunxi_cedrus_render_mpeg4_picture_parameter(VADriverContextP ctx,
 {
 	INIT_DRIVER_DATA
 	VAStatus vaStatus = VA_STATUS_SUCCESS;
+	struct sunxi_cedrus_input_slot *slot =
+		&obj_context->input_slots[obj_surface->input_buf_index];
 
 	VAPictureParameterBufferMPEG4 *pic_param = (VAPictureParameterBufferMPEG4 *)obj_buffer->buffer_data;
 
-	obj_context->mpeg4_frame_hdr.width = pic_param->vop_width;
-	obj_context->mpeg4_frame_hdr.height = pic_param->vop_height;
-
-	obj_context->mpeg4_frame_hdr.vol_fields.short_video_header = pic_param->vol_fields.bits.short_video_header;
-	obj_context->mpeg4_frame_hdr.vol_fields.chroma_format = pic_param->vol_fields.bits.chroma_format;
-	obj_context->mpeg4_frame_hdr.vol_fields.interlaced = pic_param->vol_fields.bits.interlaced;
-	obj_context->mpeg4_frame_hdr.vol_fields.obmc_disable = pic_param->vol_fields.bits.obmc_disable;
-	obj_context->mpeg4_frame_hdr.vol_fields.sprite_enable = pic_param->vol_fields.bits.sprite_enable;
-	obj_context->mpeg4_frame_hdr.vol_fields.sprite_warping_accuracy = pic_param->vol_fields.bits.sprite_warping_accuracy;
-	obj_context->mpeg4_frame_hdr.vol_fields.quant_type = pic_param->vol_fields.bits.quant_type;
-	obj_context->mpeg4_frame_hdr.vol_fields.quarter_sample = pic_param->vol_fields.bits.quarter_sample;
-	obj_context->mpeg4_frame_hdr.vol_fields.data_partitioned = pic_param->vol_fields.bits.data_partitioned;
-	obj_context->mpeg4_frame_hdr.vol_fields.reversible_vlc = pic_param->vol_fields.bits.reversible_vlc;
-	obj_context->mpeg4_frame_hdr.vol_fields.resync_marker_disable = pic_param->vol_fields.bits.resync_marker_disable;
-
-	obj_context->mpeg4_frame_hdr.vop_fields.vop_coding_type = pic_param->vop_fields.bits.vop_coding_type;
-	obj_context->mpeg4_frame_hdr.vop_fields.backward_reference_vop_coding_type = pic_param->vop_fields.bits.backward_reference_vop_coding_type;
-	obj_context->mpeg4_frame_hdr.vop_fields.vop_rounding_type = pic_param->vop_fields.bits.vop_rounding_type;
-	obj_context->mpeg4_frame_hdr.vop_fields.intra_dc_vlc_thr = pic_param->vop_fields.bits.intra_dc_vlc_thr;
-	obj_context->mpeg4_frame_hdr.vop_fields.top_field_first = pic_param->vop_fields.bits.top_field_first;
-	obj_context->mpeg4_frame_hdr.vop_fields.alternate_vertical_scan_flag = pic_param->vop_fields.bits.alternate_vertical_scan_flag;
-
-	obj_context->mpeg4_frame_hdr.vop_fcode_forward = pic_param->vop_fcode_forward;
-	obj_context->mpeg4_frame_hdr.vop_fcode_backward = pic_param->vop_fcode_backward;
-
-	obj_context->mpeg4_frame_hdr.trb = pic_param->TRB;
-	obj_context->mpeg4_frame_hdr.trd = pic_param->TRD;
+	slot->mpeg4_frame_hdr.width = pic_param->vop_width;
+	slot->mpeg4_frame_hdr.height = pic_param->vop_height;
+
+	slot->mpeg4_frame_hdr.vol_fields.short_video_header = pic_param->vol_fields.bits.short_video_header;
+	slot->mpeg4_frame_hdr.vol_fields.chroma_format = pic_param->vol_fields.bits.chroma_format;
+	slot->mpeg4_frame_hdr.vol_fields.interlaced = pic_param->vol_fields.bits.interlaced;
+	slot->mpeg4_frame_hdr.vol_fields.obmc_disable = pic_param->vol_fields.bits.obmc_disable;
+	slot->mpeg4_frame_hdr.vol_fields.sprite_enable = pic_param->vol_fields.bits.sprite_enable;
+	slot->mpeg4_frame_hdr.vol_fields.sprite_warping_accuracy = pic_param->vol_fields.bits.sprite_warping_accuracy;
+	slot->mpeg4_frame_hdr.vol_fields.quant_type = pic_param->vol_fields.bits.quant_type;
+	slot->mpeg4_frame_hdr.vol_fields.quarter_sample = pic_param->vol_fields.bits.quarter_sample;
+	slot->mpeg4_frame_hdr.vol_fields.data_partitioned = pic_param->vol_fields.bits.data_partitioned;
+	slot->mpeg4_frame_hdr.vol_fields.reversible_vlc = pic_param->vol_fields.bits.reversible_vlc;
+	slot->mpeg4_frame_hdr.vol_fields.resync_marker_disable = pic_param->vol_fields.bits.resync_marker_disable;
+
+	slot->mpeg4_frame_hdr.vop_fields.vop_coding_type = pic_param->vop_fields.bits.vop_coding_type;
+	slot->mpeg4_frame_hdr.vop_fields.backward_reference_vop_coding_type = pic_param->vop_fields.bits.backward_reference_vop_coding_type;
+	slot->mpeg4_frame_hdr.vop_fields.vop_rounding_type = pic_param->vop_fields.bits.vop_rounding_type;
+	slot->mpeg4_frame_hdr.vop_fields.intra_dc_vlc_thr = pic_param->vop_fields.bits.intra_dc_vlc_thr;
+	slot->mpeg4_frame_hdr.vop_fields.top_field_first = pic_param->vop_fields.bits.top_field_first;
+	slot->mpeg4_frame_hdr.vop_fields.alternate_vertical_scan_flag = pic_param->vop_fields.bits.alternate_vertical_scan_flag;
+
+	slot->mpeg4_frame_hdr.vop_fcode_forward = pic_param->vop_fcode_forward;
+	slot->mpeg4_frame_hdr.vop_fcode_backward = pic_param->vop_fcode_backward;
+
+	slot->mpeg4_frame_hdr.trb = pic_param->TRB;
+	slot->mpeg4_frame_hdr.trd = pic_param->TRD;
 
 	object_surface_p fwd_surface = SURFACE(pic_param->forward_reference_picture);
 	if(fwd_surface)
-		obj_context->mpeg4_frame_hdr.forward_index = fwd_surface->output_buf_index;
+		slot->mpeg4_frame_hdr.forward_index = fwd_surface->output_buf_index;
 	else
-		obj_context->mpeg4_frame_hdr.forward_index = obj_surface->output_buf_index;
+		slot->mpeg4_frame_hdr.forward_index = obj_surface->output_buf_index;
 	object_surface_p bwd_surface = SURFACE(pic_param->backward_reference_picture);
 	if(bwd_surface)
-		obj_context->mpeg4_frame_hdr.backward_index = bwd_surface->output_buf_index;
+		slot->mpeg4_frame_hdr.backward_index = bwd_surface->output_buf_index;
 	else
-		obj_context->mpeg4_frame_hdr.backward_index = obj_surface->output_buf_index;
+		slot->mpeg4_frame_hdr.backward_index = obj_surface->output_buf_index;
 
 	return vaStatus;
 }
@@ -126,10 +110,12 @@ VAStatus sunxi_cedrus_render_mpeg4_slice_parameter(VADriverContextP ctx,
 		object_buffer_p obj_buffer)
 {
 	VASliceParameterBufferMPEG4 *slice_param = (VASliceParameterBufferMPEG4 *)obj_buffer->buffer_data;
+	struct sunxi_cedrus_input_slot *slot =
+		&obj_context->input_slots[obj_surface->input_buf_index];
 
-	obj_context->mpeg4_frame_hdr.slice_pos = slice_param->slice_data_offset*8+slice_param->macroblock_offset;
-	obj_context->mpeg4_frame_hdr.slice_len = slice_param->slice_data_size*8;
-	obj_context->mpeg4_frame_hdr.quant_scale = slice_param->quant_scale;
+	slot->mpeg4_frame_hdr.slice_pos = slice_param->slice_data_offset*8+slice_param->macroblock_offset;
+	slot->mpeg4_frame_hdr.slice_len = slice_param->slice_data_size*8;
+	slot->mpeg4_frame_hdr.quant_scale = slice_param->quant_scale;
 
 	return VA_STATUS_SUCCESS;
 }
@@ -57,6 +57,7 @@ VAStatus sunxi_cedrus_BeginPicture(VADriverContextP ctx, VAContextID context,
 	VAStatus vaStatus = VA_STATUS_SUCCESS;
 	object_context_p obj_context;
 	object_surface_p obj_surface;
+	int index;
 
 	obj_context = CONTEXT(context);
 	assert(obj_context);
@@ -64,12 +65,24 @@ VAStatus sunxi_cedrus_BeginPicture(VADriverContextP ctx, VAContextID context,
 	obj_surface = SURFACE(render_target);
 	assert(obj_surface);
 
+	vaStatus = sunxi_cedrus_wait_surface_buffer(driver_data, obj_surface);
+	if (vaStatus != VA_STATUS_SUCCESS)
+		return vaStatus;
+
 	if(obj_surface->status == VASurfaceRendering)
 		sunxi_cedrus_SyncSurface(ctx, render_target);
 
+	/* The frame about to be decoded would overwrite it anyway */
+	sunxi_cedrus_drop_prefetched_image(ctx, obj_surface);
+
+	/* The slot may already hold slice data created for this picture */
+	index = sunxi_cedrus_get_input_slot(ctx, obj_context);
+	if (index < 0)
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+	obj_surface->input_buf_index = index;
+	obj_surface->request = obj_surface->input_buf_index + 1;
+	obj_surface->context_id = context;
 	obj_surface->status = VASurfaceRendering;
-	obj_surface->request = (obj_context->num_rendered_surfaces)%INPUT_BUFFERS_NB+1;
-	obj_surface->input_buf_index = obj_context->num_rendered_surfaces%INPUT_BUFFERS_NB;
 	obj_context->num_rendered_surfaces ++;
 
 	obj_context->current_render_target = obj_surface->base.id;
@@ -85,6 +98,8 @@ VAStatus sunxi_cedrus_RenderPicture(VADriverContextP ctx, VAContextID context,
 	object_context_p obj_context;
 	object_surface_p obj_surface;
 	object_config_p obj_config;
+	struct sunxi_cedrus_input_slot *slot;
+	unsigned int size;
 	int i;
 
 	obj_context = CONTEXT(context);
@@ -100,6 +115,10 @@ VAStatus sunxi_cedrus_RenderPicture(VADriverContextP ctx, VAContextID context,
 	obj_surface = SURFACE(obj_context->current_render_target);
 	assert(obj_surface);
 
+	/* The input buffers may have been lost by a failed grow */
+	if ((int) obj_surface->input_buf_index >= obj_context->num_input_slots)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
 	/* verify that we got valid buffer references */
 	for(i = 0; i < num_buffers; i++)
 	{
@@ -111,6 +130,27 @@ VAStatus sunxi_cedrus_RenderPicture(VADriverContextP ctx, VAContextID context,
 			break;
 		}
 
+		/*
+		 * Slice data is normally already in the slot of the picture,
+		 * only data created for another picture has to be copied
+		 */
+		if (obj_buffer->input_buf_index >= 0)
+		{
+			slot = &obj_context->input_slots[obj_surface->input_buf_index];
+			size = obj_buffer->size * obj_buffer->num_elements;
+
+			if (obj_buffer->buffer_data != slot->data)
+			{
+				if (size > slot->size)
+				{
+					vaStatus = VA_STATUS_ERROR_INVALID_BUFFER;
+					break;
+				}
+				memcpy(slot->data, obj_buffer->buffer_data,
+						size);
+			}
+		}
+
 		switch(obj_config->profile) {
 			case VAProfileMPEG2Simple:
 			case VAProfileMPEG2Main:
@@ -149,6 +189,8 @@ VAStatus sunxi_cedrus_EndPicture(VADriverContextP ctx, VAContextID context)
 	struct v4l2_ext_control ctrl;
 	struct v4l2_ext_controls extCtrls;
 	object_config_p obj_config;
+	struct sunxi_cedrus_input_slot *slot;
+	int i;
 
 	obj_context = CONTEXT(context);
 	assert(obj_context);
@@ -156,6 +198,10 @@ VAStatus sunxi_cedrus_EndPicture(VADriverContextP ctx, VAContextID context)
 	obj_surface = SURFACE(obj_context->current_render_target);
 	assert(obj_surface);
 
+	/* The input buffers may have been lost by a failed grow */
+	if ((int) obj_surface->input_buf_index >= obj_context->num_input_slots)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
 	obj_config = CONFIG(obj_context->config_id);
 	if (NULL == obj_config)
 	{
@@ -163,6 +209,9 @@ VAStatus sunxi_cedrus_EndPicture(VADriverContextP ctx, VAContextID context)
 		return vaStatus;
 	}
 
+	/* Each queued picture keeps its own frame header in its slot */
+	slot = &obj_context->input_slots[obj_surface->input_buf_index];
+
 	/*
 	 * The real rendering is done in EndPicture instead of RenderPicture
 	 * because the v4l2 driver expects to have the full corresponding
@@ -184,18 +233,18 @@ VAStatus sunxi_cedrus_EndPicture(VADriverContextP ctx, VAContextID context)
 	switch(obj_config->profile) {
 		case VAProfileMPEG2Simple:
 		case VAProfileMPEG2Main:
-			out_buf.m.planes[0].bytesused = obj_context->mpeg2_frame_hdr.slice_len/8;
+			out_buf.m.planes[0].bytesused = slot->mpeg2_frame_hdr.slice_len/8;
 			ctrl.id = V4L2_CID_MPEG_VIDEO_MPEG2_FRAME_HDR;
-			ctrl.ptr = &obj_context->mpeg2_frame_hdr;
-			ctrl.size = sizeof(obj_context->mpeg2_frame_hdr);
+			ctrl.ptr = &slot->mpeg2_frame_hdr;
+			ctrl.size = sizeof(slot->mpeg2_frame_hdr);
 			break;
 		case VAProfileMPEG4Simple:
 		case VAProfileMPEG4AdvancedSimple:
 		case VAProfileMPEG4Main:
-			out_buf.m.planes[0].bytesused = obj_context->mpeg4_frame_hdr.slice_len/8;
+			out_buf.m.planes[0].bytesused = slot->mpeg4_frame_hdr.slice_len/8;
 			ctrl.id = V4L2_CID_MPEG_VIDEO_MPEG4_FRAME_HDR;
-			ctrl.ptr = &obj_context->mpeg4_frame_hdr;
-			ctrl.size = sizeof(obj_context->mpeg4_frame_hdr);
+			ctrl.ptr = &slot->mpeg4_frame_hdr;
+			ctrl.size = sizeof(slot->mpeg4_frame_hdr);
 			break;
 		default:
 			out_buf.m.planes[0].bytesused = 0;
@@ -207,13 +256,24 @@ VAStatus sunxi_cedrus_EndPicture(VADriverContextP ctx, VAContextID context)
 
 	memset(&(cap_buf), 0, sizeof(cap_buf));
 	cap_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	cap_buf.memory = V4L2_MEMORY_MMAP;
+	cap_buf.memory = driver_data->capture_memory;
 	cap_buf.index = obj_surface->output_buf_index;
 	cap_buf.length = 2;
 	cap_buf.m.planes = planes;
 
 	assert(ioctl(driver_data->mem2mem_fd, VIDIOC_QUERYBUF, &cap_buf)==0);
 
+	/* Imported planes are given to the driver at each queuing */
+	if (obj_surface->import_fds[0] >= 0)
+		for (i = 0; i < 2; i++)
+		{
+			planes[i].m.fd = obj_surface->import_fds[i];
+			planes[i].length = obj_surface->import_sizes[i];
+		}
+
+	/* Prefetched images were dropped by BeginPicture */
+	sunxi_cedrus_end_cpu_access(driver_data, obj_surface);
+
 	extCtrls.controls = &ctrl;
 	extCtrls.count = 1;
 	extCtrls.request = obj_surface->request;
@@ -221,17 +281,21 @@ VAStatus sunxi_cedrus_EndPicture(VADriverContextP ctx, VAContextID context)
 
 	if(ioctl(driver_data->mem2mem_fd, VIDIOC_QBUF, &cap_buf)) {
 		obj_surface->status = VASurfaceSkipped;
+		sunxi_cedrus_queue_input_slot(obj_context, obj_surface, 0);
 		sunxi_cedrus_msg("Error when queuing output: %s\n", strerror(errno));
 		return VA_STATUS_ERROR_UNKNOWN;
 	}
 	if(ioctl(driver_data->mem2mem_fd, VIDIOC_QBUF, &out_buf)) {
 		obj_surface->status = VASurfaceSkipped;
+		sunxi_cedrus_queue_input_slot(obj_context, obj_surface, 0);
 		sunxi_cedrus_msg("Error when queuing input: %s\n", strerror(errno));
 		ioctl(driver_data->mem2mem_fd, VIDIOC_DQBUF, &cap_buf);
 		return VA_STATUS_ERROR_UNKNOWN;
 	}
 
-	/* For now, assume that we are done with rendering right away */
+	sunxi_cedrus_queue_input_slot(obj_context, obj_surface, 1);
+
+	/* The picture is decoded in the background until SyncSurface */
 	obj_context->current_render_target = -1;
 
 	return vaStatus;
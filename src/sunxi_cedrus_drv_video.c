@@ -29,6 +29,8 @@
 #include "picture.h"
 #include "subpicture.h"
 #include "surface.h"
+#include "tiled_rotate.h"
+#include "tiled_yuv.h"
 #include "va_config.h"
 
 #include "config.h"
@@ -40,6 +42,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <unistd.h>
 #include <stdarg.h>
@@ -66,16 +69,50 @@ VAStatus sunxi_cedrus_Terminate(VADriverContextP ctx)
 	INIT_DRIVER_DATA
 	object_buffer_p obj_buffer;
 	object_config_p obj_config;
+	object_image_p obj_img;
 	object_heap_iterator iter;
 	enum v4l2_buf_type type;
+	int i;
+
+	sunxi_cedrus_wait_capture_bufs(driver_data);
 
 	type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
 	ioctl(driver_data->mem2mem_fd, VIDIOC_STREAMOFF, &type);
 	type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
 	ioctl(driver_data->mem2mem_fd, VIDIOC_STREAMOFF, &type);
 
+	for (i = 0; i < VIDEO_MAX_FRAME; i++)
+	{
+		if (driver_data->luma_fds[i] >= 0)
+			close(driver_data->luma_fds[i]);
+		if (driver_data->chroma_fds[i] >= 0)
+			close(driver_data->chroma_fds[i]);
+	}
+
 	close(driver_data->mem2mem_fd);
 
+	sunxi_cedrus_workers_destroy(&driver_data->workers);
+
+	if (driver_data->stats)
+		sunxi_cedrus_msg("image pool: %u hits, %u misses\n",
+				driver_data->image_pool.hits,
+				driver_data->image_pool.misses);
+	if (driver_data->stats)
+		sunxi_cedrus_msg("capture planes: %lu bytes still mapped, %lu at most\n",
+				driver_data->mapped_size,
+				driver_data->mapped_peak);
+	if (driver_data->stats)
+		sunxi_cedrus_msg("slice data: %u bytes at most, input buffers of %u bytes\n",
+				driver_data->input_peak,
+				driver_data->input_buf_size);
+	if (driver_data->stats && driver_data->incremental)
+		sunxi_cedrus_msg("incremental conversion: %u of %u tiles converted\n",
+				driver_data->dirty_tiles.converted,
+				driver_data->dirty_tiles.tiles);
+	sunxi_cedrus_image_pool_destroy(driver_data);
+	for (i = 0; i < INCREMENTAL_SIZES; i++)
+		free(driver_data->dirty_tiles.sizes[i].signatures);
+
 	/* Clean up left over buffers */
 	obj_buffer = (object_buffer_p) object_heap_first(&driver_data->buffer_heap, &iter);
 	while (obj_buffer)
@@ -86,6 +123,16 @@ VAStatus sunxi_cedrus_Terminate(VADriverContextP ctx)
 	}
 
 	object_heap_destroy(&driver_data->buffer_heap);
+
+	/* Clean up left over images, their buffers are already gone */
+	obj_img = (object_image_p) object_heap_first(&driver_data->image_heap, &iter);
+	while (obj_img)
+	{
+		object_heap_free(&driver_data->image_heap, (object_base_p) obj_img);
+		obj_img = (object_image_p) object_heap_next(&driver_data->image_heap, &iter);
+	}
+	object_heap_destroy(&driver_data->image_heap);
+
 	object_heap_destroy(&driver_data->surface_heap);
 	object_heap_destroy(&driver_data->context_heap);
 
@@ -114,6 +161,9 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP ctx)
 	struct VADriverVTable * const vtable = ctx->vtable;
 	struct sunxi_cedrus_driver_data *driver_data;
 	struct v4l2_capability cap;
+	char *threads, *derive_format, *rgb_matrix, *rotation, *mirror;
+	char *queue_depth;
+	int i;
 
 	ctx->version_major = VA_MAJOR_VERSION;
 	ctx->version_minor = VA_MINOR_VERSION;
@@ -134,6 +184,8 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP ctx)
 	vtable->vaDestroyConfig = sunxi_cedrus_DestroyConfig;
 	vtable->vaGetConfigAttributes = sunxi_cedrus_GetConfigAttributes;
 	vtable->vaCreateSurfaces = sunxi_cedrus_CreateSurfaces;
+	vtable->vaCreateSurfaces2 = sunxi_cedrus_CreateSurfaces2;
+	vtable->vaQuerySurfaceAttributes = sunxi_cedrus_QuerySurfaceAttributes;
 	vtable->vaDestroySurfaces = sunxi_cedrus_DestroySurfaces;
 	vtable->vaCreateContext = sunxi_cedrus_CreateContext;
 	vtable->vaDestroyContext = sunxi_cedrus_DestroyContext;
@@ -169,6 +221,11 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP ctx)
 	vtable->vaLockSurface = sunxi_cedrus_LockSurface;
 	vtable->vaUnlockSurface = sunxi_cedrus_UnlockSurface;
 	vtable->vaBufferInfo = sunxi_cedrus_BufferInfo;
+#if VA_CHECK_VERSION(1, 1, 0)
+	vtable->vaExportSurfaceHandle = sunxi_cedrus_ExportSurfaceHandle;
+#endif
+
+	tiled_yuv_init(getenv("SUNXI_CEDRUS_TILED_YUV"));
 
 	driver_data = (struct sunxi_cedrus_driver_data *) malloc(sizeof(*driver_data));
 	ctx->pDriverData = (void *) driver_data;
@@ -184,6 +241,91 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP ctx)
 	assert(object_heap_init(&driver_data->image_heap,
 			sizeof(struct object_image), IMAGE_ID_OFFSET)==0);
 
+	/* Spread format conversions over all the cores by default */
+	threads = getenv("SUNXI_CEDRUS_THREADS");
+	if (sunxi_cedrus_workers_init(&driver_data->workers, threads ?
+	    atoi(threads) : sysconf(_SC_NPROCESSORS_ONLN)))
+	{
+		object_heap_destroy(&driver_data->image_heap);
+		object_heap_destroy(&driver_data->buffer_heap);
+		object_heap_destroy(&driver_data->surface_heap);
+		object_heap_destroy(&driver_data->context_heap);
+		object_heap_destroy(&driver_data->config_heap);
+		free(driver_data);
+		ctx->pDriverData = NULL;
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+	}
+
+	/* Let derived images expose the tiled planes without any copy */
+	driver_data->derive_tiled = getenv("SUNXI_CEDRUS_DERIVE_TILED") != NULL;
+	/* Convert synced surfaces in the background, needs idle workers */
+	driver_data->prefetch = getenv("SUNXI_CEDRUS_PREFETCH") != NULL &&
+		driver_data->workers.num_threads > 1;
+	/* Format of the other derived images, NV12 when unsupported */
+	derive_format = getenv("SUNXI_CEDRUS_DERIVE_FORMAT");
+	if (derive_format && strlen(derive_format) == 4)
+		driver_data->derive_fourcc = VA_FOURCC(derive_format[0],
+				derive_format[1], derive_format[2],
+				derive_format[3]);
+	else
+		driver_data->derive_fourcc = VA_FOURCC_NV12;
+	/* Only convert the tiles of NV12 derived images that changed */
+	driver_data->incremental = getenv("SUNXI_CEDRUS_INCREMENTAL") != NULL &&
+		driver_data->derive_fourcc == VA_FOURCC_NV12 &&
+		!driver_data->prefetch;
+	/* YUV to RGB matrix, picked from the height of the surface by default */
+	rgb_matrix = getenv("SUNXI_CEDRUS_RGB_MATRIX");
+	driver_data->rgb_matrix = rgb_matrix ? atoi(rgb_matrix) : 0;
+	/* Rotation in degrees and mirroring ("h", "v" or "hv") of YUV images */
+	rotation = getenv("SUNXI_CEDRUS_ROTATION");
+	driver_data->rotation = rotation ? (atoi(rotation) / 90) & 3 : 0;
+	mirror = getenv("SUNXI_CEDRUS_MIRROR");
+	driver_data->mirror = 0;
+	if (mirror && strchr(mirror, 'h'))
+		driver_data->mirror |= TILED_MIRROR_HORIZONTAL;
+	if (mirror && strchr(mirror, 'v'))
+		driver_data->mirror |= TILED_MIRROR_VERTICAL;
+	/* Back image buffers with huge pages to save page faults and TLB misses */
+	driver_data->hugepages = getenv("SUNXI_CEDRUS_HUGEPAGES") != NULL;
+	/* Read the capture planes through cached dma-buf mappings */
+	driver_data->dmabuf = getenv("SUNXI_CEDRUS_DMABUF") != NULL;
+	queue_depth = getenv("SUNXI_CEDRUS_QUEUE_DEPTH");
+	driver_data->queue_depth = queue_depth ? atoi(queue_depth) :
+		INPUT_BUFFERS_NB;
+	if (driver_data->queue_depth < 1)
+		driver_data->queue_depth = 1;
+	if (driver_data->queue_depth > INPUT_BUFFERS_MAX)
+		driver_data->queue_depth = INPUT_BUFFERS_MAX;
+	driver_data->input_peak = 0;
+	driver_data->input_buf_size = 0;
+	for (i = 0; i < VIDEO_MAX_FRAME; i++)
+	{
+		driver_data->luma_bufs[i] = NULL;
+		driver_data->chroma_bufs[i] = NULL;
+		driver_data->luma_fds[i] = -1;
+		driver_data->chroma_fds[i] = -1;
+	}
+	driver_data->capture_alloc = NULL;
+	memset(driver_data->capture_bufs, 0, sizeof(driver_data->capture_bufs));
+	driver_data->capture_stopped = 0;
+	driver_data->capture_memory = V4L2_MEMORY_MMAP;
+	driver_data->mapped_size = 0;
+	driver_data->mapped_peak = 0;
+	/* Print statistics when terminating */
+	driver_data->stats = getenv("SUNXI_CEDRUS_STATS") != NULL;
+
+	sunxi_cedrus_image_pool_init(&driver_data->image_pool);
+	for (i = 0; i < INCREMENTAL_SIZES; i++)
+	{
+		driver_data->dirty_tiles.sizes[i].width = 0;
+		driver_data->dirty_tiles.sizes[i].height = 0;
+		driver_data->dirty_tiles.sizes[i].signatures = NULL;
+		driver_data->dirty_tiles.sizes[i].num_tiles = 0;
+	}
+	driver_data->dirty_tiles.next = 0;
+	driver_data->dirty_tiles.tiles = 0;
+	driver_data->dirty_tiles.converted = 0;
+
 	driver_data->mem2mem_fd = open("/dev/video0", O_RDWR | O_NONBLOCK, 0);
 	assert(driver_data->mem2mem_fd >= 0);
 
@@ -27,7 +27,9 @@
 #define _SUNXI_CEDRUS_DRV_VIDEO_H_
 
 #include <va/va.h>
+#include "image.h"
 #include "object_heap.h"
+#include "worker.h"
 
 #include <linux/videodev2.h>
 
@@ -44,6 +46,18 @@
 
 void sunxi_cedrus_msg(const char *msg, ...);
 
+/* State of a capture buffer index */
+#define CAPTURE_BUF_NONE	0
+#define CAPTURE_BUF_FREE	1
+#define CAPTURE_BUF_USED	2
+
+/* Buffers of destroyed Surfaces are reused for Surfaces of the same size */
+struct sunxi_cedrus_capture_buf {
+	int state;
+	int width;
+	int height;
+};
+
 struct sunxi_cedrus_driver_data {
 	struct object_heap	config_heap;
 	struct object_heap	context_heap;
@@ -52,8 +66,40 @@ struct sunxi_cedrus_driver_data {
 	struct object_heap	image_heap;
 	char                   *luma_bufs[VIDEO_MAX_FRAME];
 	char                   *chroma_bufs[VIDEO_MAX_FRAME];
+	/* dma-buf of the capture planes, -1 when mapped from the v4l device */
+	int			luma_fds[VIDEO_MAX_FRAME];
+	int			chroma_fds[VIDEO_MAX_FRAME];
+	/* Bytes of capture planes currently mapped, and at most */
+	unsigned long		mapped_size;
+	unsigned long		mapped_peak;
 	unsigned int		num_dst_bufs;
+	/* Capture buffers still being created, NULL when none */
+	struct sunxi_cedrus_capture_alloc *capture_alloc;
+	struct sunxi_cedrus_capture_buf capture_bufs[VIDEO_MAX_FRAME];
+	/* Whether the capture queue was stopped to free all its buffers */
+	int capture_stopped;
+	/* V4L2_MEMORY_MMAP, or V4L2_MEMORY_DMABUF for imported Surfaces */
+	unsigned int		capture_memory;
 	int			mem2mem_fd;
+	int			derive_tiled;
+	unsigned int		derive_fourcc;
+	int			rgb_matrix;
+	/* VA_ROTATION_* and TILED_MIRROR_* applied to the YUV images */
+	unsigned int		rotation;
+	unsigned int		mirror;
+	int			prefetch;
+	int			incremental;
+	int			hugepages;
+	int			dmabuf;
+	/* Number of pictures that can be queued before waiting for one */
+	int			queue_depth;
+	/* Largest slice data and input buffer, for the statistics */
+	unsigned int		input_peak;
+	unsigned int		input_buf_size;
+	int			stats;
+	struct sunxi_cedrus_workers workers;
+	struct sunxi_cedrus_image_pool image_pool;
+	struct sunxi_cedrus_dirty_tiles dirty_tiles;
 };
 
 #endif /* _SUNXI_CEDRUS_DRV_VIDEO_H_ */
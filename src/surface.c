@@ -24,27 +24,74 @@
  */
 
 #include "sunxi_cedrus_drv_video.h"
+#include "context.h"
 #include "surface.h"
 
+#include "config.h"
+
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 
+#include <linux/dma-buf.h>
 #include <linux/videodev2.h>
 
 #include <X11/Xlib.h>
 
+#if VA_CHECK_VERSION(1, 1, 0)
+#include <va/va_drmcommon.h>
+#endif
+
+#ifdef HAVE_DRM_FOURCC_H
+#include <drm_fourcc.h>
+#endif
+
+#ifndef DRM_FORMAT_NV12
+#define DRM_FORMAT_NV12			0x3231564e
+#endif
+#ifndef DRM_FORMAT_R8
+#define DRM_FORMAT_R8			0x20203852
+#endif
+#ifndef DRM_FORMAT_GR88
+#define DRM_FORMAT_GR88			0x38385247
+#endif
+/* 32x32 tiles of the VPU, added to drm_fourcc.h by Linux 4.18 */
+#ifndef DRM_FORMAT_MOD_ALLWINNER_TILED
+#define DRM_FORMAT_MOD_ALLWINNER_TILED	((0x09ULL << 56) | 1)
+#endif
+
 /*
  * A Surface is an internal data structure never handled by the VA's user
  * containing the output of a rendering. Usualy, a bunch of surfaces are created
  * at the begining of decoding and they are then used alternatively. When
  * created, a surface is assigned a corresponding v4l capture buffer and it is
  * kept until the end of decoding. Syncing a surface waits for the v4l buffer to
- * be available and then dequeue it.
+ * be available and then dequeue it. The planes of the buffer are only mapped
+ * the first time the surface is read, and unmapped when it is destroyed.
+ *
+ * Since allocating the capture buffers can take a while, they are created by
+ * the workers while CreateSurfaces returns right away. Using the buffer of a
+ * Surface waits for its creation to be done.
+ *
+ * The planes of a Surface can also be exported as dma-bufs, described with
+ * the Allwinner tiled DRM format modifier, to be displayed or sampled without
+ * any conversion.
+ *
+ * Destroying a Surface releases its buffer with VIDIOC_REMOVE_BUFS when the
+ * kernel has it, otherwise the buffer is kept for the next Surfaces of the
+ * same size. Once no Surface is left, the capture queue is stopped and all its
+ * buffers are freed.
+ *
+ * Optionally, the planes of the capture buffers are exported as dma-bufs and
+ * mapped from them, which lets the CPU cache them. Caches are then synced when
+ * the buffer is dequeued and the CPU starts reading it, and when it is queued
+ * again and the CPU is done with it.
  *
  * Note: since a Surface is kept private from the VA's user, it can ask to
  * directly render a Surface on screen in an X Drawable. Some kind of
@@ -52,42 +99,493 @@
  * purpose.
  */
 
-VAStatus sunxi_cedrus_CreateSurfaces(VADriverContextP ctx, int width,
-		int height, int format, int num_surfaces, VASurfaceID *surfaces)
+/* Returns a dma-buf of a plane of a capture buffer, or -1 on error */
+static int sunxi_cedrus_export_plane(
+		struct sunxi_cedrus_driver_data *driver_data,
+		unsigned int index, unsigned int plane, int flags)
 {
-	INIT_DRIVER_DATA
-	VAStatus vaStatus = VA_STATUS_SUCCESS;
-	int i;
+	struct v4l2_exportbuffer expbuf;
+
+	memset(&expbuf, 0, sizeof(expbuf));
+	expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	expbuf.index = index;
+	expbuf.plane = plane;
+	expbuf.flags = flags | O_CLOEXEC;
+	if (ioctl(driver_data->mem2mem_fd, VIDIOC_EXPBUF, &expbuf))
+	{
+		sunxi_cedrus_msg("Error when exporting output: %s\n",
+				strerror(errno));
+		return -1;
+	}
+
+	return expbuf.fd;
+}
+
+/*
+ * Maps a plane of a capture buffer at addr, from its dma-buf when possible and
+ * from the v4l device otherwise. Imported planes are always mapped from the
+ * dma-buf they were given with. Returns NULL on error.
+ */
+static char *sunxi_cedrus_map_plane(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, struct v4l2_buffer *buf,
+		unsigned int plane, char *addr, int *fd)
+{
+	void *data;
+
+	*fd = -1;
+
+	if (obj_surface->import_fds[plane] >= 0)
+	{
+		*fd = fcntl(obj_surface->import_fds[plane], F_DUPFD_CLOEXEC, 0);
+		if (*fd < 0)
+			return NULL;
+
+		data = mmap(addr, buf->m.planes[plane].length,
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+				*fd, 0);
+		if (data == MAP_FAILED)
+		{
+			sunxi_cedrus_msg("Error when mapping imported plane: %s\n",
+					strerror(errno));
+			close(*fd);
+			*fd = -1;
+			return NULL;
+		}
+		return data;
+	}
+
+	if (driver_data->dmabuf)
+		*fd = sunxi_cedrus_export_plane(driver_data, buf->index, plane,
+				O_RDWR);
+
+	if (*fd >= 0)
+	{
+		data = mmap(addr, buf->m.planes[plane].length,
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+				*fd, 0);
+		if (data != MAP_FAILED)
+			return data;
+
+		close(*fd);
+		*fd = -1;
+	}
+
+	data = mmap(addr, buf->m.planes[plane].length, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED, driver_data->mem2mem_fd,
+			buf->m.planes[plane].m.mem_offset);
+
+	return data != MAP_FAILED ? data : NULL;
+}
+
+static void sunxi_cedrus_sync_plane(int fd, uint64_t flags)
+{
+	struct dma_buf_sync sync;
+
+	if (fd < 0)
+		return;
+
+	sync.flags = flags;
+	while (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) && errno == EINTR);
+}
+
+/* Invalidates the CPU caches of the planes the device just wrote */
+void sunxi_cedrus_begin_cpu_access(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface)
+{
+	unsigned int index = obj_surface->output_buf_index;
+
+	if (obj_surface->cpu_access)
+		return;
+
+	sunxi_cedrus_sync_plane(driver_data->luma_fds[index],
+			DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+	sunxi_cedrus_sync_plane(driver_data->chroma_fds[index],
+			DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+	obj_surface->cpu_access = 1;
+}
+
+/* Counts size more bytes of the planes of the Surface as mapped */
+static void sunxi_cedrus_count_mapping(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, unsigned int size)
+{
+	obj_surface->mapped_size += size;
+	driver_data->mapped_size += size;
+	if (driver_data->mapped_size > driver_data->mapped_peak)
+		driver_data->mapped_peak = driver_data->mapped_size;
+}
+
+VAStatus sunxi_cedrus_map_surface(struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, int chroma)
+{
+	unsigned int index;
 	struct v4l2_buffer buf;
 	struct v4l2_plane planes[2];
-	struct v4l2_create_buffers create_bufs;
-	struct v4l2_format fmt;
+	long page_size = sysconf(_SC_PAGESIZE);
+	unsigned int luma_size;
+	char *planes_buf;
+
+	if (obj_surface->map_size)
+	{
+		index = obj_surface->output_buf_index;
+		if (!chroma || driver_data->chroma_bufs[index])
+			return VA_STATUS_SUCCESS;
+	}
+	else if (sunxi_cedrus_wait_surface_buffer(driver_data, obj_surface) !=
+		 VA_STATUS_SUCCESS)
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+	index = obj_surface->output_buf_index;
 
 	memset(planes, 0, 2 * sizeof(struct v4l2_plane));
+	memset(&(buf), 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	buf.memory = driver_data->capture_memory;
+	buf.index = index;
+	buf.length = 2;
+	buf.m.planes = planes;
 
-	/* We only support one format */
-	if (VA_RT_FORMAT_YUV420 != format)
-		return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+	if (ioctl(driver_data->mem2mem_fd, VIDIOC_QUERYBUF, &buf))
+		return VA_STATUS_ERROR_OPERATION_FAILED;
 
-	/* Set format for capture */
-	memset(&(fmt), 0, sizeof(fmt));
-	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	fmt.fmt.pix_mp.width = width;
-	fmt.fmt.pix_mp.height = height;
-	fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_SUNXI;
-	fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
-	fmt.fmt.pix_mp.num_planes = 2;
-	assert(ioctl(driver_data->mem2mem_fd, VIDIOC_S_FMT, &fmt)==0);
+	if (obj_surface->import_fds[0] >= 0)
+	{
+		planes[0].length = obj_surface->import_sizes[0];
+		planes[1].length = obj_surface->import_sizes[1];
+	}
+
+	luma_size = (buf.m.planes[0].length + page_size - 1) & ~(page_size - 1);
+
+	/* The chroma plane is only mapped once a reader needs it */
+	if (obj_surface->map_size)
+	{
+		planes_buf = driver_data->luma_bufs[index] + luma_size;
+		driver_data->chroma_bufs[index] = sunxi_cedrus_map_plane(
+				driver_data, obj_surface, &buf, 1, planes_buf,
+				&driver_data->chroma_fds[index]);
+		/* A failed MAP_FIXED may have dropped the reservation */
+		if (NULL == driver_data->chroma_bufs[index])
+		{
+			mmap(planes_buf, buf.m.planes[1].length, PROT_NONE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+					-1, 0);
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+		}
+		sunxi_cedrus_count_mapping(driver_data, obj_surface,
+				buf.m.planes[1].length);
+		if (obj_surface->cpu_access)
+			sunxi_cedrus_sync_plane(driver_data->chroma_fds[index],
+					DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+		return VA_STATUS_SUCCESS;
+	}
+
+	/*
+	 * Room is kept for both planes next to each other so that they can be
+	 * exposed as a single buffer by a tiled derived image
+	 */
+	planes_buf = mmap(NULL, luma_size + buf.m.planes[1].length, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (planes_buf == MAP_FAILED)
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+	driver_data->luma_bufs[index] = sunxi_cedrus_map_plane(driver_data,
+			obj_surface, &buf, 0, planes_buf,
+			&driver_data->luma_fds[index]);
+	if (chroma && driver_data->luma_bufs[index])
+		driver_data->chroma_bufs[index] = sunxi_cedrus_map_plane(
+				driver_data, obj_surface, &buf, 1,
+				planes_buf + luma_size,
+				&driver_data->chroma_fds[index]);
+	if (NULL == driver_data->luma_bufs[index] ||
+	    (chroma && NULL == driver_data->chroma_bufs[index]))
+	{
+		munmap(planes_buf, luma_size + buf.m.planes[1].length);
+		driver_data->luma_bufs[index] = NULL;
+		if (driver_data->luma_fds[index] >= 0)
+			close(driver_data->luma_fds[index]);
+		driver_data->luma_fds[index] = -1;
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
+	obj_surface->map_size = luma_size + buf.m.planes[1].length;
+
+	/* Only the planes mapped count, not the whole reservation */
+	sunxi_cedrus_count_mapping(driver_data, obj_surface,
+			chroma ? obj_surface->map_size : luma_size);
+
+	/* The buffer may have been dequeued before being mapped */
+	if (obj_surface->cpu_access)
+	{
+		obj_surface->cpu_access = 0;
+		sunxi_cedrus_begin_cpu_access(driver_data, obj_surface);
+	}
+
+	return VA_STATUS_SUCCESS;
+}
+
+static void sunxi_cedrus_unmap_surface(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface)
+{
+	unsigned int index = obj_surface->output_buf_index;
 
-	memset (&create_bufs, 0, sizeof (struct v4l2_create_buffers));
-	create_bufs.count = num_surfaces;
-	create_bufs.memory = V4L2_MEMORY_MMAP;
-	create_bufs.format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	assert(ioctl(driver_data->mem2mem_fd, VIDIOC_G_FMT, &create_bufs.format)==0);
-	assert(ioctl(driver_data->mem2mem_fd, VIDIOC_CREATE_BUFS, &create_bufs)==0);
-	driver_data->num_dst_bufs = create_bufs.count;
+	if (!obj_surface->map_size)
+		return;
 
-	for (i = 0; i < create_bufs.count; i++)
+	sunxi_cedrus_end_cpu_access(driver_data, obj_surface);
+
+	munmap(driver_data->luma_bufs[index], obj_surface->map_size);
+	driver_data->luma_bufs[index] = NULL;
+	driver_data->chroma_bufs[index] = NULL;
+	if (driver_data->luma_fds[index] >= 0)
+		close(driver_data->luma_fds[index]);
+	if (driver_data->chroma_fds[index] >= 0)
+		close(driver_data->chroma_fds[index]);
+	driver_data->luma_fds[index] = -1;
+	driver_data->chroma_fds[index] = -1;
+
+	driver_data->mapped_size -= obj_surface->mapped_size;
+	obj_surface->mapped_size = 0;
+	obj_surface->map_size = 0;
+}
+
+/* Must be called before the device writes the planes again */
+void sunxi_cedrus_end_cpu_access(struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface)
+{
+	unsigned int index = obj_surface->output_buf_index;
+
+	if (!obj_surface->cpu_access)
+		return;
+
+	sunxi_cedrus_sync_plane(driver_data->luma_fds[index],
+			DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+	sunxi_cedrus_sync_plane(driver_data->chroma_fds[index],
+			DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+	obj_surface->cpu_access = 0;
+}
+
+static void sunxi_cedrus_capture_alloc_job(void *arg)
+{
+	struct sunxi_cedrus_capture_alloc *alloc = arg;
+
+	if (ioctl(alloc->driver_data->mem2mem_fd, VIDIOC_CREATE_BUFS,
+	    &alloc->create_bufs))
+		alloc->result = errno;
+	else
+		alloc->result = 0;
+}
+
+VAStatus sunxi_cedrus_wait_capture_bufs(
+		struct sunxi_cedrus_driver_data *driver_data)
+{
+	struct sunxi_cedrus_capture_alloc *alloc = driver_data->capture_alloc;
+	object_surface_p obj_surface;
+	int i;
+
+	if (NULL == alloc)
+		return VA_STATUS_SUCCESS;
+
+	sunxi_cedrus_workers_wait(&driver_data->workers, &alloc->job);
+	driver_data->capture_alloc = NULL;
+
+	if (alloc->result)
+		sunxi_cedrus_msg("Error when creating output buffers: %s\n",
+				strerror(alloc->result));
+	else
+		driver_data->num_dst_bufs = alloc->create_bufs.count;
+
+	/* The driver may have created fewer buffers than requested */
+	for (i = 0; i < alloc->num_surfaces; i++)
+	{
+		unsigned int index = alloc->create_bufs.index + i;
+		struct sunxi_cedrus_capture_buf *capture_buf;
+
+		if (alloc->result || i >= alloc->create_bufs.count)
+			index = VIDEO_MAX_FRAME;
+
+		obj_surface = SURFACE(alloc->surfaces[i]);
+		if (index >= VIDEO_MAX_FRAME)
+		{
+			if (obj_surface)
+				obj_surface->buffer_state =
+					SURFACE_BUFFER_FAILED;
+			continue;
+		}
+
+		/* Surfaces destroyed meanwhile leave their buffer free */
+		capture_buf = &driver_data->capture_bufs[index];
+		capture_buf->width = alloc->width;
+		capture_buf->height = alloc->height;
+		if (NULL == obj_surface)
+		{
+			capture_buf->state = CAPTURE_BUF_FREE;
+			continue;
+		}
+
+		capture_buf->state = CAPTURE_BUF_USED;
+		obj_surface->output_buf_index = index;
+		obj_surface->buffer_state = SURFACE_BUFFER_READY;
+	}
+
+	if (!alloc->result && driver_data->capture_stopped)
+	{
+		enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+		ioctl(driver_data->mem2mem_fd, VIDIOC_STREAMON, &type);
+		driver_data->capture_stopped = 0;
+	}
+
+	i = alloc->result;
+	free(alloc);
+
+	return i ? VA_STATUS_ERROR_ALLOCATION_FAILED : VA_STATUS_SUCCESS;
+}
+
+VAStatus sunxi_cedrus_wait_surface_buffer(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface)
+{
+	if (obj_surface->buffer_state == SURFACE_BUFFER_PENDING)
+		sunxi_cedrus_wait_capture_bufs(driver_data);
+
+	return obj_surface->buffer_state == SURFACE_BUFFER_READY ?
+		VA_STATUS_SUCCESS : VA_STATUS_ERROR_ALLOCATION_FAILED;
+}
+
+/* Returns the index of a free buffer for a Surface of that size, or -1 */
+static int sunxi_cedrus_reuse_capture_buf(
+		struct sunxi_cedrus_driver_data *driver_data, int width,
+		int height, unsigned int memory)
+{
+	struct sunxi_cedrus_capture_buf *capture_buf;
+	int i;
+
+	if (memory != driver_data->capture_memory)
+		return -1;
+
+	for (i = 0; i < VIDEO_MAX_FRAME; i++)
+	{
+		capture_buf = &driver_data->capture_bufs[i];
+		if (capture_buf->state == CAPTURE_BUF_FREE &&
+		    capture_buf->width == width &&
+		    capture_buf->height == height)
+		{
+			capture_buf->state = CAPTURE_BUF_USED;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/* The buffer must have been dequeued and unmapped */
+static void sunxi_cedrus_release_capture_buf(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface)
+{
+	unsigned int index = obj_surface->output_buf_index;
+#ifdef VIDIOC_REMOVE_BUFS
+	struct v4l2_remove_buffers remove_bufs;
+#endif
+
+	if (obj_surface->buffer_state != SURFACE_BUFFER_READY)
+		return;
+
+#ifdef VIDIOC_REMOVE_BUFS
+	memset(&remove_bufs, 0, sizeof(remove_bufs));
+	remove_bufs.index = index;
+	remove_bufs.count = 1;
+	remove_bufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	if (ioctl(driver_data->mem2mem_fd, VIDIOC_REMOVE_BUFS,
+	    &remove_bufs) == 0)
+	{
+		driver_data->capture_bufs[index].state = CAPTURE_BUF_NONE;
+		return;
+	}
+#endif
+
+	driver_data->capture_bufs[index].state = CAPTURE_BUF_FREE;
+}
+
+/* Frees all the capture buffers once none of them is used anymore */
+static void sunxi_cedrus_free_capture_bufs(
+		struct sunxi_cedrus_driver_data *driver_data)
+{
+	struct v4l2_requestbuffers reqbufs;
+	enum v4l2_buf_type type;
+	int i, num_free = 0;
+
+	for (i = 0; i < VIDEO_MAX_FRAME; i++)
+		if (driver_data->capture_bufs[i].state == CAPTURE_BUF_USED)
+			return;
+		else if (driver_data->capture_bufs[i].state ==
+			 CAPTURE_BUF_FREE)
+			num_free++;
+
+	if (num_free == 0)
+		return;
+
+	type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	ioctl(driver_data->mem2mem_fd, VIDIOC_STREAMOFF, &type);
+
+	memset(&reqbufs, 0, sizeof(reqbufs));
+	reqbufs.count = 0;
+	reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	reqbufs.memory = driver_data->capture_memory;
+	if (ioctl(driver_data->mem2mem_fd, VIDIOC_REQBUFS, &reqbufs))
+	{
+		sunxi_cedrus_msg("Error when freeing output buffers: %s\n",
+				strerror(errno));
+		return;
+	}
+
+	for (i = 0; i < VIDEO_MAX_FRAME; i++)
+		driver_data->capture_bufs[i].state = CAPTURE_BUF_NONE;
+	driver_data->capture_stopped = 1;
+}
+
+/*
+ * Creates Surfaces decoded into buffers of the driver, or into the dma-bufs
+ * of imports for V4L2_MEMORY_DMABUF
+ */
+static VAStatus sunxi_cedrus_create_surfaces(VADriverContextP ctx, int width,
+		int height, int num_surfaces, VASurfaceID *surfaces,
+		unsigned int memory,
+		const struct sunxi_cedrus_surface_import *imports)
+{
+	INIT_DRIVER_DATA
+	VAStatus vaStatus = VA_STATUS_SUCCESS;
+	int i, index;
+	struct sunxi_cedrus_capture_alloc *alloc;
+	struct v4l2_format fmt;
+
+	/* Only one batch of buffers is created at a time */
+	sunxi_cedrus_wait_capture_bufs(driver_data);
+
+	/* All the buffers of the queue share the same kind of memory */
+	if (memory != driver_data->capture_memory)
+	{
+		for (i = 0; i < VIDEO_MAX_FRAME; i++)
+			if (driver_data->capture_bufs[i].state !=
+			    CAPTURE_BUF_NONE)
+			{
+				sunxi_cedrus_msg("Surfaces can't mix imported and allocated buffers\n");
+				return VA_STATUS_ERROR_ALLOCATION_FAILED;
+			}
+		driver_data->capture_memory = memory;
+	}
+
+	alloc = malloc(sizeof(*alloc) + num_surfaces * sizeof(VASurfaceID));
+	if (NULL == alloc)
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+	alloc->driver_data = driver_data;
+	alloc->surfaces = (VASurfaceID *) (alloc + 1);
+	alloc->num_surfaces = 0;
+	alloc->width = width;
+	alloc->height = height;
+
+	for (i = 0; i < num_surfaces; i++)
 	{
 		int surfaceID = object_heap_allocate(&driver_data->surface_heap);
 		object_surface_p obj_surface = SURFACE(surfaceID);
@@ -99,31 +597,34 @@ VAStatus sunxi_cedrus_CreateSurfaces(VADriverContextP ctx, int width,
 		obj_surface->surface_id = surfaceID;
 		surfaces[i] = surfaceID;
 
-		memset(&(buf), 0, sizeof(buf));
-		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.index = create_bufs.index + i;
-		buf.length = 2;
-		buf.m.planes = planes;
-
-		assert(ioctl(driver_data->mem2mem_fd, VIDIOC_QUERYBUF, &buf)==0);
-
-		driver_data->luma_bufs[buf.index] = mmap(NULL, buf.m.planes[0].length,
-				PROT_READ | PROT_WRITE, MAP_SHARED,
-				driver_data->mem2mem_fd, buf.m.planes[0].m.mem_offset);
-		assert(driver_data->luma_bufs[buf.index] != MAP_FAILED);
-
-		driver_data->chroma_bufs[buf.index] = mmap(NULL, buf.m.planes[1].length,
-				PROT_READ | PROT_WRITE, MAP_SHARED,
-				driver_data->mem2mem_fd, buf.m.planes[1].m.mem_offset);
-		assert(driver_data->chroma_bufs[buf.index] != MAP_FAILED);
+		/* Only the Surfaces without a free buffer need a new one */
+		index = sunxi_cedrus_reuse_capture_buf(driver_data, width,
+				height, memory);
+		if (index >= 0)
+		{
+			obj_surface->output_buf_index = index;
+			obj_surface->buffer_state = SURFACE_BUFFER_READY;
+		}
+		else
+		{
+			obj_surface->output_buf_index = 0;
+			obj_surface->buffer_state = SURFACE_BUFFER_PENDING;
+			alloc->surfaces[alloc->num_surfaces++] = surfaceID;
+		}
 
+		obj_surface->context_id = VA_INVALID_ID;
 		obj_surface->input_buf_index = 0;
-		obj_surface->output_buf_index = create_bufs.index + i;
-
 		obj_surface->width = width;
 		obj_surface->height = height;
 		obj_surface->status = VASurfaceReady;
+		obj_surface->prefetch.image.image_id = VA_INVALID_ID;
+		obj_surface->cpu_access = 0;
+		obj_surface->map_size = 0;
+		obj_surface->mapped_size = 0;
+		obj_surface->import_fds[0] = imports ? imports[i].fds[0] : -1;
+		obj_surface->import_fds[1] = imports ? imports[i].fds[1] : -1;
+		obj_surface->import_sizes[0] = imports ? imports[i].sizes[0] : 0;
+		obj_surface->import_sizes[1] = imports ? imports[i].sizes[1] : 0;
 	}
 
 	/* Error recovery */
@@ -135,28 +636,310 @@ VAStatus sunxi_cedrus_CreateSurfaces(VADriverContextP ctx, int width,
 			object_surface_p obj_surface = SURFACE(surfaces[i]);
 			surfaces[i] = VA_INVALID_SURFACE;
 			assert(obj_surface);
+			sunxi_cedrus_release_capture_buf(driver_data,
+					obj_surface);
 			object_heap_free(&driver_data->surface_heap, (object_base_p) obj_surface);
 		}
+		free(alloc);
+		return vaStatus;
+	}
+
+	if (alloc->num_surfaces == 0)
+	{
+		free(alloc);
+		return vaStatus;
 	}
+
+	/* Set format for capture */
+	memset(&(fmt), 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	fmt.fmt.pix_mp.width = width;
+	fmt.fmt.pix_mp.height = height;
+	fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_SUNXI;
+	fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+	fmt.fmt.pix_mp.num_planes = 2;
+	assert(ioctl(driver_data->mem2mem_fd, VIDIOC_S_FMT, &fmt)==0);
+
+	memset (&alloc->create_bufs, 0, sizeof (struct v4l2_create_buffers));
+	alloc->create_bufs.count = alloc->num_surfaces;
+	alloc->create_bufs.memory = memory;
+	alloc->create_bufs.format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+#ifdef V4L2_MEMORY_FLAG_NON_COHERENT
+	/* dma-buf mappings are only cached when the buffers allow it */
+	if (driver_data->dmabuf && memory == V4L2_MEMORY_MMAP)
+		alloc->create_bufs.flags = V4L2_MEMORY_FLAG_NON_COHERENT;
+#endif
+	assert(ioctl(driver_data->mem2mem_fd, VIDIOC_G_FMT, &alloc->create_bufs.format)==0);
+
+	driver_data->capture_alloc = alloc;
+	sunxi_cedrus_workers_queue(&driver_data->workers, &alloc->job,
+			sunxi_cedrus_capture_alloc_job, alloc);
+
 	return vaStatus;
 }
 
+VAStatus sunxi_cedrus_CreateSurfaces(VADriverContextP ctx, int width,
+		int height, int format, int num_surfaces, VASurfaceID *surfaces)
+{
+	/* We only support one format */
+	if (VA_RT_FORMAT_YUV420 != format)
+		return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+
+	return sunxi_cedrus_create_surfaces(ctx, width, height, num_surfaces,
+			surfaces, V4L2_MEMORY_MMAP, NULL);
+}
+
+#if VA_CHECK_VERSION(1, 1, 0)
+/*
+ * The VPU writes each tiled plane at the start of its own buffer, so each
+ * plane must be a different dma-buf, used from offset 0 and large enough
+ */
+static VAStatus sunxi_cedrus_import_descriptor(
+		struct sunxi_cedrus_driver_data *driver_data,
+		VADRMPRIMESurfaceDescriptor *desc, int width, int height,
+		struct sunxi_cedrus_surface_import *import)
+{
+	uint32_t pitch = (width + 31) & ~31;
+	uint32_t object[2], offset[2], pitches[2];
+	struct v4l2_format fmt;
+	int i;
+
+	if (desc->fourcc != VA_FOURCC_NV12 || desc->width != width ||
+	    desc->height != height)
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+	if (desc->num_layers == 1 && desc->layers[0].num_planes == 2)
+		for (i = 0; i < 2; i++)
+		{
+			object[i] = desc->layers[0].object_index[i];
+			offset[i] = desc->layers[0].offset[i];
+			pitches[i] = desc->layers[0].pitch[i];
+		}
+	else if (desc->num_layers == 2 && desc->layers[0].num_planes == 1 &&
+		 desc->layers[1].num_planes == 1)
+		for (i = 0; i < 2; i++)
+		{
+			object[i] = desc->layers[i].object_index[0];
+			offset[i] = desc->layers[i].offset[0];
+			pitches[i] = desc->layers[i].pitch[0];
+		}
+	else
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+	if (object[0] == object[1])
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+	memset(&(fmt), 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	fmt.fmt.pix_mp.width = width;
+	fmt.fmt.pix_mp.height = height;
+	fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_SUNXI;
+	fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+	fmt.fmt.pix_mp.num_planes = 2;
+	if (ioctl(driver_data->mem2mem_fd, VIDIOC_TRY_FMT, &fmt))
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	for (i = 0; i < 2; i++)
+	{
+		if (object[i] >= desc->num_objects || offset[i] != 0 ||
+		    pitches[i] != pitch ||
+		    desc->objects[object[i]].drm_format_modifier !=
+		    DRM_FORMAT_MOD_ALLWINNER_TILED ||
+		    desc->objects[object[i]].size <
+		    fmt.fmt.pix_mp.plane_fmt[i].sizeimage)
+			return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+		import->fds[i] = desc->objects[object[i]].fd;
+		import->sizes[i] = desc->objects[object[i]].size;
+	}
+
+	return VA_STATUS_SUCCESS;
+}
+#endif
+
+/*
+ * Imported dma-bufs are described by a DRM PRIME 2 descriptor, one Surface at
+ * a time. Their file descriptors are duplicated, the caller keeps its own.
+ */
+VAStatus sunxi_cedrus_CreateSurfaces2(VADriverContextP ctx,
+		unsigned int format, unsigned int width, unsigned int height,
+		VASurfaceID *surfaces, unsigned int num_surfaces,
+		VASurfaceAttrib *attrib_list, unsigned int num_attribs)
+{
+	unsigned int memory_type = VA_SURFACE_ATTRIB_MEM_TYPE_VA;
+	void *descriptor = NULL;
+	unsigned int i;
+#if VA_CHECK_VERSION(1, 1, 0)
+	INIT_DRIVER_DATA
+	struct sunxi_cedrus_surface_import import;
+	VAStatus ret;
+#endif
+
+	if (VA_RT_FORMAT_YUV420 != format)
+		return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+
+	for (i = 0; i < num_attribs; i++)
+	{
+		if (!(attrib_list[i].flags & VA_SURFACE_ATTRIB_SETTABLE))
+			continue;
+
+		switch (attrib_list[i].type) {
+			case VASurfaceAttribPixelFormat:
+				if (attrib_list[i].value.value.i !=
+				    VA_FOURCC_NV12)
+					return VA_STATUS_ERROR_INVALID_PARAMETER;
+				break;
+			case VASurfaceAttribMemoryType:
+				memory_type = attrib_list[i].value.value.i;
+				break;
+			case VASurfaceAttribExternalBufferDescriptor:
+				descriptor = attrib_list[i].value.value.p;
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (memory_type == VA_SURFACE_ATTRIB_MEM_TYPE_VA)
+		return sunxi_cedrus_CreateSurfaces(ctx, width, height, format,
+				num_surfaces, surfaces);
+
+#if VA_CHECK_VERSION(1, 1, 0)
+	if (memory_type == VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2)
+	{
+		if (NULL == descriptor || num_surfaces != 1)
+			return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+		ret = sunxi_cedrus_import_descriptor(driver_data, descriptor,
+				width, height, &import);
+		if (ret != VA_STATUS_SUCCESS)
+			return ret;
+
+		import.fds[0] = fcntl(import.fds[0], F_DUPFD_CLOEXEC, 0);
+		import.fds[1] = fcntl(import.fds[1], F_DUPFD_CLOEXEC, 0);
+		if (import.fds[0] >= 0 && import.fds[1] >= 0)
+			ret = sunxi_cedrus_create_surfaces(ctx, width, height,
+					1, surfaces, V4L2_MEMORY_DMABUF,
+					&import);
+		else
+			ret = VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+		if (ret != VA_STATUS_SUCCESS)
+		{
+			if (import.fds[0] >= 0)
+				close(import.fds[0]);
+			if (import.fds[1] >= 0)
+				close(import.fds[1]);
+		}
+
+		return ret;
+	}
+#endif
+
+	/* A single DRM PRIME object can't hold the chroma plane at an offset */
+	return VA_STATUS_ERROR_UNSUPPORTED_MEMORY_TYPE;
+}
+
+VAStatus sunxi_cedrus_QuerySurfaceAttributes(VADriverContextP ctx,
+		VAConfigID config, VASurfaceAttrib *attrib_list,
+		unsigned int *num_attribs)
+{
+	VASurfaceAttrib attribs[3];
+	unsigned int i = 0;
+
+	attribs[i].type = VASurfaceAttribPixelFormat;
+	attribs[i].flags = VA_SURFACE_ATTRIB_GETTABLE |
+		VA_SURFACE_ATTRIB_SETTABLE;
+	attribs[i].value.type = VAGenericValueTypeInteger;
+	attribs[i].value.value.i = VA_FOURCC_NV12;
+	i++;
+
+	attribs[i].type = VASurfaceAttribMemoryType;
+	attribs[i].flags = VA_SURFACE_ATTRIB_GETTABLE |
+		VA_SURFACE_ATTRIB_SETTABLE;
+	attribs[i].value.type = VAGenericValueTypeInteger;
+	attribs[i].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_VA;
+#if VA_CHECK_VERSION(1, 1, 0)
+	attribs[i].value.value.i |= VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2;
+#endif
+	i++;
+
+	attribs[i].type = VASurfaceAttribExternalBufferDescriptor;
+	attribs[i].flags = VA_SURFACE_ATTRIB_SETTABLE;
+	attribs[i].value.type = VAGenericValueTypePointer;
+	attribs[i].value.value.p = NULL;
+	i++;
+
+	/* Only the number of attributes is returned when there is no list */
+	if (attrib_list && *num_attribs < i)
+	{
+		*num_attribs = i;
+		return VA_STATUS_ERROR_MAX_NUM_EXCEEDED;
+	}
+
+	if (attrib_list)
+		memcpy(attrib_list, attribs, i * sizeof(VASurfaceAttrib));
+	*num_attribs = i;
+
+	return VA_STATUS_SUCCESS;
+}
+
 VAStatus sunxi_cedrus_DestroySurfaces(VADriverContextP ctx,
 		VASurfaceID *surface_list, int num_surfaces)
 {
 	INIT_DRIVER_DATA
 	int i;
+
+	/* Lets the pending batch find which of its Surfaces remain */
+	sunxi_cedrus_wait_capture_bufs(driver_data);
+
 	for(i = num_surfaces; i--;)
 	{
 		object_surface_p obj_surface = SURFACE(surface_list[i]);
 		assert(obj_surface);
+		/* Queued buffers can't be released */
+		if (obj_surface->status == VASurfaceRendering)
+			sunxi_cedrus_SyncSurface(ctx, surface_list[i]);
+		sunxi_cedrus_drop_prefetched_image(ctx, obj_surface);
+		sunxi_cedrus_unmap_surface(driver_data, obj_surface);
+		sunxi_cedrus_release_capture_buf(driver_data, obj_surface);
+		if (obj_surface->import_fds[0] >= 0)
+			close(obj_surface->import_fds[0]);
+		if (obj_surface->import_fds[1] >= 0)
+			close(obj_surface->import_fds[1]);
 		object_heap_free(&driver_data->surface_heap, (object_base_p) obj_surface);
 	}
+
+	sunxi_cedrus_free_capture_bufs(driver_data);
 	return VA_STATUS_SUCCESS;
 }
 
-VAStatus sunxi_cedrus_SyncSurface(VADriverContextP ctx,
-		VASurfaceID render_target)
+/* Returns the Surface being decoded into a capture buffer, NULL if none */
+static object_surface_p sunxi_cedrus_find_rendering_surface(
+		struct sunxi_cedrus_driver_data *driver_data,
+		unsigned int index)
+{
+	object_heap_iterator iter;
+	object_surface_p obj_surface;
+
+	obj_surface = (object_surface_p) object_heap_first(&driver_data->surface_heap, &iter);
+	while (obj_surface)
+	{
+		if (obj_surface->status == VASurfaceRendering &&
+		    obj_surface->buffer_state == SURFACE_BUFFER_READY &&
+		    obj_surface->output_buf_index == index)
+			return obj_surface;
+		obj_surface = (object_surface_p) object_heap_next(&driver_data->surface_heap, &iter);
+	}
+
+	return NULL;
+}
+
+/*
+ * Dequeues the oldest decoded picture, whichever Surface it belongs to, and
+ * gives its input slot back to its context
+ */
+static VAStatus sunxi_cedrus_dequeue_picture(VADriverContextP ctx)
 {
 	INIT_DRIVER_DATA
 	object_surface_p obj_surface;
@@ -169,20 +952,13 @@ VAStatus sunxi_cedrus_SyncSurface(VADriverContextP ctx,
 	memset(plane, 0, sizeof(struct v4l2_plane));
 	memset(planes, 0, 2 * sizeof(struct v4l2_plane));
 
-	obj_surface = SURFACE(render_target);
-	assert(obj_surface);
-
 	FD_ZERO(&read_fds);
 	FD_SET(driver_data->mem2mem_fd, &read_fds);
-	if(obj_surface->status != VASurfaceSkipped)
-		select(driver_data->mem2mem_fd + 1, &read_fds, NULL, NULL, &tv);
-	else
-		return VA_STATUS_ERROR_UNKNOWN;
+	select(driver_data->mem2mem_fd + 1, &read_fds, NULL, NULL, &tv);
 
 	memset(&(buf), 0, sizeof(buf));
 	buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
 	buf.memory = V4L2_MEMORY_MMAP;
-	buf.index = obj_surface->input_buf_index;
 	buf.length = 1;
 	buf.m.planes = plane;
 
@@ -193,18 +969,56 @@ VAStatus sunxi_cedrus_SyncSurface(VADriverContextP ctx,
 
 	memset(&(buf), 0, sizeof(buf));
 	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	buf.memory = V4L2_MEMORY_MMAP;
-	buf.index = obj_surface->output_buf_index;
+	buf.memory = driver_data->capture_memory;
 	buf.length = 2;
 	buf.m.planes = planes;
 
-	obj_surface->status = VASurfaceReady;
-
 	if(ioctl(driver_data->mem2mem_fd, VIDIOC_DQBUF, &buf)) {
 		sunxi_cedrus_msg("Error when dequeuing output: %s\n", strerror(errno));
 		return VA_STATUS_ERROR_UNKNOWN;
 	}
 
+	obj_surface = sunxi_cedrus_find_rendering_surface(driver_data,
+			buf.index);
+	if (NULL == obj_surface)
+	{
+		sunxi_cedrus_msg("Dequeued output %d of no surface\n", buf.index);
+		return VA_STATUS_ERROR_UNKNOWN;
+	}
+
+	obj_surface->status = VASurfaceReady;
+	sunxi_cedrus_release_input_slot(ctx, obj_surface);
+
+	sunxi_cedrus_begin_cpu_access(driver_data, obj_surface);
+	sunxi_cedrus_prefetch_image(ctx, obj_surface);
+
+	return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Pictures are decoded in the order they were queued, so the ones queued before
+ * that of the Surface are dequeued first
+ */
+VAStatus sunxi_cedrus_SyncSurface(VADriverContextP ctx,
+		VASurfaceID render_target)
+{
+	INIT_DRIVER_DATA
+	object_surface_p obj_surface;
+	VAStatus ret;
+
+	obj_surface = SURFACE(render_target);
+	assert(obj_surface);
+
+	if(obj_surface->status == VASurfaceSkipped)
+		return VA_STATUS_ERROR_UNKNOWN;
+
+	while (obj_surface->status == VASurfaceRendering)
+	{
+		ret = sunxi_cedrus_dequeue_picture(ctx);
+		if (ret != VA_STATUS_SUCCESS)
+			return ret;
+	}
+
 	return VA_STATUS_SUCCESS;
 }
 
@@ -252,6 +1066,12 @@ VAStatus sunxi_cedrus_PutSurface(VADriverContextP ctx, VASurfaceID surface,
 	}
 
 	sunxi_cedrus_msg("warning: using vaPutSurface with sunxi-cedrus is not recommended\n");
+	if (sunxi_cedrus_map_surface(driver_data, obj_surface, 1) !=
+	    VA_STATUS_SUCCESS)
+	{
+		XCloseDisplay(display);
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
 	screen = DefaultScreen(display);
 	gc =  XCreateGC(display, RootWindow(display, screen), 0, NULL);
 	XSync(display, False);
@@ -284,3 +1104,105 @@ VAStatus sunxi_cedrus_LockSurface(VADriverContextP ctx, VASurfaceID surface,
 
 VAStatus sunxi_cedrus_UnlockSurface(VADriverContextP ctx, VASurfaceID surface)
 { return VA_STATUS_ERROR_UNIMPLEMENTED; }
+
+#if VA_CHECK_VERSION(1, 1, 0)
+VAStatus sunxi_cedrus_ExportSurfaceHandle(VADriverContextP ctx,
+		VASurfaceID surface_id, uint32_t mem_type, uint32_t flags,
+		void *descriptor)
+{
+	INIT_DRIVER_DATA
+	VADRMPRIMESurfaceDescriptor *desc = descriptor;
+	object_surface_p obj_surface;
+	struct v4l2_buffer buf;
+	struct v4l2_plane planes[2];
+	unsigned int pitch;
+	VAStatus ret;
+	int access, i;
+
+	if (mem_type != VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2)
+		return VA_STATUS_ERROR_UNSUPPORTED_MEMORY_TYPE;
+
+	obj_surface = SURFACE(surface_id);
+	if (NULL == obj_surface)
+		return VA_STATUS_ERROR_INVALID_SURFACE;
+
+	ret = sunxi_cedrus_wait_surface_buffer(driver_data, obj_surface);
+	if (ret != VA_STATUS_SUCCESS)
+		return ret;
+
+	memset(planes, 0, 2 * sizeof(struct v4l2_plane));
+	memset(&(buf), 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	buf.memory = driver_data->capture_memory;
+	buf.index = obj_surface->output_buf_index;
+	buf.length = 2;
+	buf.m.planes = planes;
+
+	if (ioctl(driver_data->mem2mem_fd, VIDIOC_QUERYBUF, &buf))
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	if (obj_surface->import_fds[0] >= 0)
+	{
+		planes[0].length = obj_surface->import_sizes[0];
+		planes[1].length = obj_surface->import_sizes[1];
+	}
+
+	access = flags & VA_EXPORT_SURFACE_WRITE_ONLY ? O_RDWR : O_RDONLY;
+
+	/* Each plane is a buffer of its own, the dma-bufs belong to the user */
+	for (i = 0; i < 2; i++)
+	{
+		if (obj_surface->import_fds[i] >= 0)
+			desc->objects[i].fd = fcntl(obj_surface->import_fds[i],
+					F_DUPFD_CLOEXEC, 0);
+		else
+			desc->objects[i].fd = sunxi_cedrus_export_plane(
+					driver_data, buf.index, i, access);
+		if (desc->objects[i].fd < 0)
+		{
+			if (i > 0)
+				close(desc->objects[0].fd);
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+		}
+		desc->objects[i].size = buf.m.planes[i].length;
+		desc->objects[i].drm_format_modifier =
+			DRM_FORMAT_MOD_ALLWINNER_TILED;
+	}
+
+	desc->fourcc = VA_FOURCC_NV12;
+	desc->width = obj_surface->width;
+	desc->height = obj_surface->height;
+	desc->num_objects = 2;
+
+	/* Lines of tiles are made of whole tiles */
+	pitch = (obj_surface->width + 31) & ~31;
+
+	if (flags & VA_EXPORT_SURFACE_SEPARATE_LAYERS)
+	{
+		desc->num_layers = 2;
+		for (i = 0; i < 2; i++)
+		{
+			desc->layers[i].drm_format = i ? DRM_FORMAT_GR88 :
+				DRM_FORMAT_R8;
+			desc->layers[i].num_planes = 1;
+			desc->layers[i].object_index[0] = i;
+			desc->layers[i].offset[0] = 0;
+			desc->layers[i].pitch[0] = pitch;
+		}
+	}
+	else
+	{
+		desc->num_layers = 1;
+		desc->layers[0].drm_format = DRM_FORMAT_NV12;
+		desc->layers[0].num_planes = 2;
+		for (i = 0; i < 2; i++)
+		{
+			desc->layers[0].object_index[i] = i;
+			desc->layers[0].offset[i] = 0;
+			desc->layers[0].pitch[i] = pitch;
+		}
+	}
+
+	return VA_STATUS_SUCCESS;
+}
+#endif
@@ -28,8 +28,16 @@
 
 #include <va/va_backend.h>
 
+#include "image.h"
 #include "object_heap.h"
 
+#include <linux/videodev2.h>
+
+/* State of the capture buffer of a Surface, created in the background */
+#define SURFACE_BUFFER_PENDING		0
+#define SURFACE_BUFFER_READY		1
+#define SURFACE_BUFFER_FAILED		2
+
 #define SURFACE(id) ((object_surface_p) object_heap_lookup(&driver_data->surface_heap, id))
 #define SURFACE_ID_OFFSET		0x04000000
 
@@ -37,24 +45,89 @@ struct object_surface {
 	struct object_base base;
 	VASurfaceID surface_id;
 	uint32_t request;
+	/* Context the Surface was last rendered by, owning its input slot */
+	VAContextID context_id;
 	uint32_t input_buf_index;
 	uint32_t output_buf_index;
+	int buffer_state;
 	int width;
 	int height;
 	VAStatus status;
+	/* The image_id of prefetch.image is VA_INVALID_ID when not started */
+	struct sunxi_cedrus_prefetch prefetch;
+	/* Whether the CPU is between the start and the end of its access */
+	int cpu_access;
+	/* Size of the mapping of both planes, 0 until the Surface is read */
+	unsigned int map_size;
+	/* Bytes of the planes actually mapped in the reservation */
+	unsigned int mapped_size;
+	/* dma-bufs the planes are decoded into, -1 for buffers of the driver */
+	int import_fds[2];
+	unsigned int import_sizes[2];
 };
 
 typedef struct object_surface *object_surface_p;
 
+/* Planes of a Surface imported from dma-bufs */
+struct sunxi_cedrus_surface_import {
+	int fds[2];
+	unsigned int sizes[2];
+};
+
+/* Batch of capture buffers created by the workers for CreateSurfaces */
+struct sunxi_cedrus_capture_alloc {
+	struct sunxi_cedrus_job job;
+	struct sunxi_cedrus_driver_data *driver_data;
+	struct v4l2_create_buffers create_bufs;
+	/* errno of VIDIOC_CREATE_BUFS, 0 on success */
+	int result;
+	VASurfaceID *surfaces;
+	int num_surfaces;
+	int width;
+	int height;
+};
+
+/* Waits for the pending batch and gives the buffers to its Surfaces */
+VAStatus sunxi_cedrus_wait_capture_bufs(
+		struct sunxi_cedrus_driver_data *driver_data);
+
+/* Returns an error when the Surface ended up without a buffer */
+VAStatus sunxi_cedrus_wait_surface_buffer(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface);
+
 VAStatus sunxi_cedrus_CreateSurfaces(VADriverContextP ctx, int width,
 		int height, int format, int num_surfaces, VASurfaceID *surfaces);
 
+VAStatus sunxi_cedrus_CreateSurfaces2(VADriverContextP ctx,
+		unsigned int format, unsigned int width, unsigned int height,
+		VASurfaceID *surfaces, unsigned int num_surfaces,
+		VASurfaceAttrib *attrib_list, unsigned int num_attribs);
+
+VAStatus sunxi_cedrus_QuerySurfaceAttributes(VADriverContextP ctx,
+		VAConfigID config, VASurfaceAttrib *attrib_list,
+		unsigned int *num_attribs);
+
 VAStatus sunxi_cedrus_DestroySurfaces(VADriverContextP ctx,
 		VASurfaceID *surface_list, int num_surfaces);
 
 VAStatus sunxi_cedrus_SyncSurface(VADriverContextP ctx,
 		VASurfaceID render_target);
 
+void sunxi_cedrus_begin_cpu_access(
+		struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface);
+
+/*
+ * Maps the luma plane of the Surface's capture buffer if it isn't yet, and the
+ * chroma plane too when chroma is set
+ */
+VAStatus sunxi_cedrus_map_surface(struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface, int chroma);
+
+void sunxi_cedrus_end_cpu_access(struct sunxi_cedrus_driver_data *driver_data,
+		object_surface_p obj_surface);
+
 VAStatus sunxi_cedrus_QuerySurfaceStatus(VADriverContextP ctx,
 		VASurfaceID render_target, VASurfaceStatus *status);
 
@@ -74,4 +147,10 @@ VAStatus sunxi_cedrus_LockSurface(VADriverContextP ctx, VASurfaceID surface,
 
 VAStatus sunxi_cedrus_UnlockSurface(VADriverContextP ctx, VASurfaceID surface);
 
+#if VA_CHECK_VERSION(1, 1, 0)
+VAStatus sunxi_cedrus_ExportSurfaceHandle(VADriverContextP ctx,
+		VASurfaceID surface_id, uint32_t mem_type, uint32_t flags,
+		void *descriptor);
+#endif
+
 #endif /* _SURFACES_H_ */
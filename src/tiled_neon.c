@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+/*
+ * NEON intrinsics versions of the tiled to RGB converter and of the tile
+ * signature. This file alone is built with -mfpu=neon on 32-bit ARM, the rest
+ * of the driver running on CPUs without NEON: tiled_has_neon must be checked
+ * before calling these functions.
+ */
+
+#include "tiled_rgb.h"
+#include "tiled_yuv.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+/* Converts 16 pixels starting on a 16 pixels boundary of a tile */
+static inline void tiled_rgb_block_neon(const uint8_t *l, const uint8_t *c,
+		uint8_t *d, enum tiled_rgb_format format,
+		const struct tiled_rgb_matrix *matrix)
+{
+	uint8x16_t luma = vld1q_u8(l);
+	uint8x8x2_t uv = vld2_u8(c);
+	int16x8_t u = vreinterpretq_s16_u16(vsubl_u8(uv.val[0], vdup_n_u8(128)));
+	int16x8_t v = vreinterpretq_s16_u16(vsubl_u8(uv.val[1], vdup_n_u8(128)));
+	int16x8x2_t rv, guv, bu;
+	int16x8_t y[2];
+	uint8x8_t r[2], g[2], b[2];
+	int i;
+
+	/* Each chroma sample is used by two neighbour pixels */
+	rv = vzipq_s16(vmulq_n_s16(v, matrix->rv), vmulq_n_s16(v, matrix->rv));
+	guv.val[0] = vmlaq_n_s16(vmulq_n_s16(u, matrix->gu), v, matrix->gv);
+	guv = vzipq_s16(guv.val[0], guv.val[0]);
+	bu = vzipq_s16(vmulq_n_s16(u, matrix->bu), vmulq_n_s16(u, matrix->bu));
+
+	y[0] = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(luma), vdup_n_u8(16)));
+	y[1] = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(luma), vdup_n_u8(16)));
+
+	for (i = 0; i < 2; i++)
+	{
+		y[i] = vmulq_n_s16(y[i], matrix->y);
+		r[i] = vqrshrun_n_s16(vqaddq_s16(y[i], rv.val[i]), 6);
+		g[i] = vqrshrun_n_s16(vqsubq_s16(y[i], guv.val[i]), 6);
+		b[i] = vqrshrun_n_s16(vqaddq_s16(y[i], bu.val[i]), 6);
+	}
+
+	if (format == TILED_RGB_BGRA)
+	{
+		uint8x16x4_t bgra;
+
+		bgra.val[0] = vcombine_u8(b[0], b[1]);
+		bgra.val[1] = vcombine_u8(g[0], g[1]);
+		bgra.val[2] = vcombine_u8(r[0], r[1]);
+		bgra.val[3] = vdupq_n_u8(0xff);
+		vst4q_u8(d, bgra);
+	}
+	else
+	{
+		for (i = 0; i < 2; i++)
+		{
+			uint16x8_t rgb = vshll_n_u8(r[i], 8);
+
+			rgb = vsriq_n_u16(rgb, vshll_n_u8(g[i], 8), 5);
+			rgb = vsriq_n_u16(rgb, vshll_n_u8(b[i], 8), 11);
+			vst1q_u8(d + i * 16, vreinterpretq_u8_u16(rgb));
+		}
+	}
+}
+
+void tiled_rgb_blocks_neon(const uint8_t *ls, const uint8_t *cs,
+		unsigned int start, unsigned int end, uint8_t *d,
+		enum tiled_rgb_format format,
+		const struct tiled_rgb_matrix *matrix)
+{
+	unsigned int bpp = tiled_rgb_bpp(format);
+	unsigned int i;
+
+	for (i = start; i < end; i += 16, d += 16 * bpp)
+	{
+		size_t offset = (i / 32) * 1024 + i % 32;
+
+		tiled_rgb_block_neon(ls + offset, cs + offset, d, format, matrix);
+	}
+}
+
+static inline uint32_t tiled_signature_add_lanes(uint32x4_t v)
+{
+	uint32x2_t s = vadd_u32(vget_low_u32(v), vget_high_u32(v));
+
+	return vget_lane_u32(vpadd_u32(s, s), 0);
+}
+
+uint64_t tiled_signature_neon(const void *tile)
+{
+	const uint32_t *t = tile;
+	static const uint32_t first_weights[4] = { 1, 2, 3, 4 };
+	uint32x4_t weights = vld1q_u32(first_weights);
+	uint32x4_t sum = vdupq_n_u32(0), weighted = vdupq_n_u32(0);
+	unsigned int i;
+
+	for (i = 0; i < 256; i += 4)
+	{
+		uint32x4_t words = vld1q_u32(t + i);
+
+		sum = vaddq_u32(sum, words);
+		weighted = vmlaq_u32(weighted, words, weights);
+		weights = vaddq_u32(weights, vdupq_n_u32(4));
+	}
+
+	return (uint64_t) tiled_signature_add_lanes(weighted) << 32 |
+		tiled_signature_add_lanes(sum);
+}
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+/*
+ * Tiled NV12 to RGB converters. Reading the tiles and converting the colors in
+ * the same pass saves a full planar NV12 picture from being written and read
+ * back by the users wanting RGB. On CPUs with NEON, tiled_neon.c converts 16
+ * pixels at once and the C version handles the other pixels. Both compute the
+ * exact same values.
+ */
+
+#include "config.h"
+
+#include "tiled_rgb.h"
+#include "tiled_yuv.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+const struct tiled_rgb_matrix tiled_rgb_bt601 = { 75, 102, 25, 52, 129 };
+const struct tiled_rgb_matrix tiled_rgb_bt709 = { 75, 115, 14, 34, 135 };
+
+#define TILE_LINE(width)	((size_t) (((width) + 31) & ~31) * 32)
+
+static inline uint8_t tiled_rgb_clamp(int value)
+{
+	value = (value + 32) >> 6;
+	return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+static inline void tiled_rgb_pixel(uint8_t luma, uint8_t u, uint8_t v,
+		uint8_t *d, enum tiled_rgb_format format,
+		const struct tiled_rgb_matrix *matrix)
+{
+	int y = (luma - 16) * matrix->y;
+	uint8_t r = tiled_rgb_clamp(y + (v - 128) * matrix->rv);
+	uint8_t g = tiled_rgb_clamp(y - (u - 128) * matrix->gu -
+			(v - 128) * matrix->gv);
+	uint8_t b = tiled_rgb_clamp(y + (u - 128) * matrix->bu);
+	uint16_t rgb;
+
+	switch (format) {
+		case TILED_RGB_BGRA:
+			d[0] = b;
+			d[1] = g;
+			d[2] = r;
+			d[3] = 0xff;
+			break;
+		case TILED_RGB_RGB565:
+			rgb = (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+			d[0] = rgb & 0xff;
+			d[1] = rgb >> 8;
+			break;
+	}
+}
+
+/* Converts pixels [start, end[ of a line, ls and cs point to its first tiles */
+static void tiled_rgb_line_c(const uint8_t *ls, const uint8_t *cs,
+		unsigned int start, unsigned int end, uint8_t *d,
+		enum tiled_rgb_format format,
+		const struct tiled_rgb_matrix *matrix)
+{
+	unsigned int bpp = tiled_rgb_bpp(format);
+	unsigned int i;
+
+	for (i = start; i < end; i++, d += bpp)
+	{
+		const uint8_t *c = cs + (i / 32) * 1024 + (i % 32 & ~1);
+
+		tiled_rgb_pixel(ls[(i / 32) * 1024 + i % 32], c[0], c[1], d,
+				format, matrix);
+	}
+}
+
+#ifdef HAVE_NEON_INTRINSICS
+static void tiled_rgb_line_neon(const uint8_t *ls, const uint8_t *cs,
+		unsigned int start, unsigned int end, uint8_t *d,
+		enum tiled_rgb_format format,
+		const struct tiled_rgb_matrix *matrix)
+{
+	unsigned int bpp = tiled_rgb_bpp(format);
+	unsigned int first = (start + 15) & ~15;
+	unsigned int i;
+
+	if (first >= end)
+	{
+		tiled_rgb_line_c(ls, cs, start, end, d, format, matrix);
+		return;
+	}
+
+	tiled_rgb_line_c(ls, cs, start, first, d, format, matrix);
+	d += (first - start) * bpp;
+
+	i = first + ((end - first) & ~15);
+	tiled_rgb_blocks_neon(ls, cs, first, i, d, format, matrix);
+	d += (i - first) * bpp;
+
+	tiled_rgb_line_c(ls, cs, i, end, d, format, matrix);
+}
+#endif
+
+static void tiled_to_rgb(void *luma, void *chroma, unsigned int src_width,
+		unsigned int x, unsigned int y, void *dst, unsigned int dst_pitch,
+		unsigned int width, unsigned int height,
+		enum tiled_rgb_format format,
+		const struct tiled_rgb_matrix *matrix, int neon)
+{
+	size_t tile_line = TILE_LINE(src_width);
+	unsigned int j;
+
+	for (j = 0; j < height; j++)
+	{
+		unsigned int ly = y + j, cy = ly / 2;
+		const uint8_t *ls = (const uint8_t *) luma + (ly / 32) * tile_line +
+				(ly % 32) * 32;
+		const uint8_t *cs = (const uint8_t *) chroma +
+				(cy / 32) * tile_line + (cy % 32) * 32;
+		uint8_t *d = (uint8_t *) dst + (size_t) j * dst_pitch;
+
+#ifdef HAVE_NEON_INTRINSICS
+		if (neon)
+		{
+			tiled_rgb_line_neon(ls, cs, x, x + width, d, format,
+					matrix);
+			continue;
+		}
+#endif
+		tiled_rgb_line_c(ls, cs, x, x + width, d, format, matrix);
+	}
+}
+
+void tiled_to_rgb_region(void *luma, void *chroma, unsigned int src_width,
+                         unsigned int x, unsigned int y,
+                         void *dst, unsigned int dst_pitch,
+                         unsigned int width, unsigned int height,
+                         enum tiled_rgb_format format,
+                         const struct tiled_rgb_matrix *matrix)
+{
+	tiled_to_rgb(luma, chroma, src_width, x, y, dst, dst_pitch, width,
+			height, format, matrix, tiled_has_neon());
+}
+
+void tiled_to_rgb_region_c(void *luma, void *chroma, unsigned int src_width,
+                           unsigned int x, unsigned int y,
+                           void *dst, unsigned int dst_pitch,
+                           unsigned int width, unsigned int height,
+                           enum tiled_rgb_format format,
+                           const struct tiled_rgb_matrix *matrix)
+{
+	tiled_to_rgb(luma, chroma, src_width, x, y, dst, dst_pitch, width,
+			height, format, matrix, 0);
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef __TILED_RGB_H__
+#define __TILED_RGB_H__
+
+#include <stdint.h>
+
+enum tiled_rgb_format {
+	TILED_RGB_BGRA,		/* B, G, R, 0xff bytes, also used for BGRX */
+	TILED_RGB_RGB565,	/* little endian 5:6:5 words */
+};
+
+/*
+ * Limited range YCbCr to RGB coefficients in 1/64th:
+ * R = y * (Y - 16) + rv * (V - 128)
+ * G = y * (Y - 16) - gu * (U - 128) - gv * (V - 128)
+ * B = y * (Y - 16) + bu * (U - 128)
+ */
+struct tiled_rgb_matrix {
+	short y;
+	short rv;
+	short gu;
+	short gv;
+	short bu;
+};
+
+static inline unsigned int tiled_rgb_bpp(enum tiled_rgb_format format)
+{
+	return format == TILED_RGB_BGRA ? 4 : 2;
+}
+
+extern const struct tiled_rgb_matrix tiled_rgb_bt601;
+extern const struct tiled_rgb_matrix tiled_rgb_bt709;
+
+/*
+ * Converts the width x height region at (x, y) of a tiled NV12 picture
+ * src_width pixels wide to packed RGB, reading the tiled luma and chroma planes
+ * directly. Chroma samples are shared by 2x2 pixels.
+ */
+void tiled_to_rgb_region(void *luma, void *chroma, unsigned int src_width,
+                         unsigned int x, unsigned int y,
+                         void *dst, unsigned int dst_pitch,
+                         unsigned int width, unsigned int height,
+                         enum tiled_rgb_format format,
+                         const struct tiled_rgb_matrix *matrix);
+
+/* Portable reference implementation */
+void tiled_to_rgb_region_c(void *luma, void *chroma, unsigned int src_width,
+                           unsigned int x, unsigned int y,
+                           void *dst, unsigned int dst_pitch,
+                           unsigned int width, unsigned int height,
+                           enum tiled_rgb_format format,
+                           const struct tiled_rgb_matrix *matrix);
+
+#if defined(__arm__) || defined(__aarch64__)
+/*
+ * Converts pixels [start, end[ of a line in blocks of 16, start and end must be
+ * multiples of 16
+ */
+void tiled_rgb_blocks_neon(const uint8_t *ls, const uint8_t *cs,
+                           unsigned int start, unsigned int end, uint8_t *d,
+                           enum tiled_rgb_format format,
+                           const struct tiled_rgb_matrix *matrix);
+#endif
+
+#endif
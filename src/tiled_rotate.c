@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+/*
+ * Rotation and mirroring of the tiled planes while reading them. The source is
+ * read tile after tile, each line of a tile being written along a line or a
+ * column of the destination, so that a 90 degrees rotation is a transposition
+ * of 32x32 blocks that stays in cache rather than a pass over whole columns.
+ */
+
+#include "tiled_rotate.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TILE_LINE(width)	((size_t) (((width) + 31) & ~31) * 32)
+
+/* Returns the destination coordinates of a source sample of the region */
+static void tiled_rotate_map(const struct tiled_rotate *rotate, int sx, int sy,
+		int *dx, int *dy)
+{
+	int w = rotate->width, h = rotate->height;
+
+	if (rotate->mirror & TILED_MIRROR_HORIZONTAL)
+		sx = w - 1 - sx;
+	if (rotate->mirror & TILED_MIRROR_VERTICAL)
+		sy = h - 1 - sy;
+
+	switch (rotate->rotation) {
+		case TILED_ROTATE_90:
+			*dx = h - 1 - sy;
+			*dy = sx;
+			break;
+		case TILED_ROTATE_180:
+			*dx = w - 1 - sx;
+			*dy = h - 1 - sy;
+			break;
+		case TILED_ROTATE_270:
+			*dx = sy;
+			*dy = w - 1 - sx;
+			break;
+		default:
+			*dx = sx;
+			*dy = sy;
+			break;
+	}
+}
+
+void tiled_rotate_lines(const struct tiled_rotate *rotate, unsigned int first,
+                        unsigned int last)
+{
+	unsigned int components = rotate->components;
+	unsigned int dst_components = rotate->dst2 ? 1 : components;
+	size_t tile_line = TILE_LINE(rotate->src_width);
+	ptrdiff_t origin, step_x, step_y;
+	unsigned int start, end, line, byte, sx, n;
+	int x0, y0, x1, y1;
+
+	/* The mapping is affine, the destination moves by steps */
+	tiled_rotate_map(rotate, 0, 0, &x0, &y0);
+	origin = (ptrdiff_t) x0 * dst_components + (ptrdiff_t) y0 *
+			rotate->dst_pitch;
+	tiled_rotate_map(rotate, 1, 0, &x1, &y1);
+	step_x = (ptrdiff_t) (x1 - x0) * dst_components +
+			(ptrdiff_t) (y1 - y0) * rotate->dst_pitch;
+	tiled_rotate_map(rotate, 0, 1, &x1, &y1);
+	step_y = (ptrdiff_t) (x1 - x0) * dst_components +
+			(ptrdiff_t) (y1 - y0) * rotate->dst_pitch;
+
+	for (start = first; start < last; start = end)
+	{
+		/* Lines of the region within the same line of tiles */
+		end = (rotate->y + start) / 32 * 32 + 32 - rotate->y;
+		if (end > last)
+			end = last;
+
+		for (byte = rotate->x * components & ~31;
+		     byte < (rotate->x + rotate->width) * components;
+		     byte += 32)
+		{
+			/* Samples of the region within this column of tiles */
+			sx = byte / components > rotate->x ?
+					byte / components - rotate->x : 0;
+			n = (byte + 32) / components - rotate->x - sx;
+			if (sx + n > rotate->width)
+				n = rotate->width - sx;
+
+			for (line = start; line < end; line++)
+			{
+				const uint8_t *s = (const uint8_t *) rotate->src +
+						((rotate->y + line) / 32) * tile_line +
+						((rotate->y + line) % 32) * 32 +
+						(byte / 32) * 1024 +
+						(rotate->x + sx) * components % 32;
+				ptrdiff_t d = origin + sx * step_x +
+						line * step_y;
+				uint8_t *d1 = (uint8_t *) rotate->dst1 + d;
+				unsigned int i;
+
+				if (components == 1)
+					for (i = 0; i < n; i++, d1 += step_x)
+						*d1 = s[i];
+				else if (rotate->dst2)
+				{
+					uint8_t *d2 = (uint8_t *) rotate->dst2 + d;
+
+					for (i = 0; i < n; i++, s += 2,
+					     d1 += step_x, d2 += step_x)
+					{
+						*d1 = s[0];
+						*d2 = s[1];
+					}
+				}
+				else
+					for (i = 0; i < n; i++, s += 2,
+					     d1 += step_x)
+					{
+						d1[0] = s[0];
+						d1[1] = s[1];
+					}
+			}
+		}
+	}
+}
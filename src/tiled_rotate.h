@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef __TILED_ROTATE_H__
+#define __TILED_ROTATE_H__
+
+/* Clockwise quarter turns */
+#define TILED_ROTATE_0		0
+#define TILED_ROTATE_90		1
+#define TILED_ROTATE_180	2
+#define TILED_ROTATE_270	3
+
+/* Mirroring is applied to the source, before the rotation */
+#define TILED_MIRROR_HORIZONTAL	(1 << 0)
+#define TILED_MIRROR_VERTICAL	(1 << 1)
+
+/*
+ * Rotation and mirroring of the width x height region at (x, y) of a tiled
+ * plane src_width bytes wide. Samples are made of one byte per component like
+ * in struct tiled_scale, coordinates and sizes are in samples. The destination
+ * is height x width samples for quarter and three quarter turns.
+ */
+struct tiled_rotate {
+	void *src;
+	unsigned int src_width;
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+	unsigned int components;
+	void *dst1;
+	void *dst2;
+	unsigned int dst_pitch;
+	unsigned int rotation;
+	unsigned int mirror;
+};
+
+/*
+ * Moves the source lines first to last - 1 of the region to their place in
+ * the destination, tile after tile so that the destination lines written by
+ * a tile stay in cache
+ */
+void tiled_rotate_lines(const struct tiled_rotate *rotate, unsigned int first,
+                        unsigned int last);
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+/*
+ * Scaling of the tiled planes while reading them, so that previews and
+ * thumbnails never go through a full size planar copy. Lines of the source are
+ * located once per destination line, only the tiles actually sampled are read.
+ */
+
+#include "tiled_scale.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TILE_LINE(width)	((size_t) (((width) + 31) & ~31) * 32)
+
+/* Returns the first byte of a line of the region */
+static inline const uint8_t *tiled_scale_line(const struct tiled_scale *scale,
+		unsigned int line)
+{
+	line += scale->y;
+	return (const uint8_t *) scale->src + (line / 32) *
+			TILE_LINE(scale->src_width) + (line % 32) * 32;
+}
+
+/* Returns a component of a sample of a line */
+static inline unsigned int tiled_scale_sample(const struct tiled_scale *scale,
+		const uint8_t *line, unsigned int sample, unsigned int component)
+{
+	unsigned int byte = (scale->x + sample) * scale->components + component;
+
+	return line[(byte / 32) * 1024 + byte % 32];
+}
+
+static inline void tiled_scale_store(const struct tiled_scale *scale,
+		unsigned int line, unsigned int sample, unsigned int component,
+		unsigned int value)
+{
+	size_t offset = (size_t) line * scale->dst_pitch;
+
+	if (scale->dst2)
+		((uint8_t *) (component ? scale->dst2 : scale->dst1))
+				[offset + sample] = value;
+	else
+		((uint8_t *) scale->dst1)
+				[offset + sample * scale->components + component] = value;
+}
+
+static void tiled_scale_box(const struct tiled_scale *scale,
+		unsigned int factor, unsigned int first, unsigned int last)
+{
+	const uint8_t *lines[4];
+	unsigned int i, j, c, k, l, sum;
+
+	for (j = first; j < last; j++)
+	{
+		for (k = 0; k < factor; k++)
+			lines[k] = tiled_scale_line(scale, j * factor + k);
+
+		for (i = 0; i < scale->dst_width; i++)
+		{
+			for (c = 0; c < scale->components; c++)
+			{
+				sum = factor * factor / 2;
+				for (k = 0; k < factor; k++)
+					for (l = 0; l < factor; l++)
+						sum += tiled_scale_sample(scale,
+								lines[k],
+								i * factor + l, c);
+				tiled_scale_store(scale, j, i, c,
+						sum / (factor * factor));
+			}
+		}
+	}
+}
+
+/*
+ * Maps the center of a destination sample to the source, returns the 16.16
+ * fixed point position clamped to the region
+ */
+static inline unsigned int tiled_scale_position(unsigned int index,
+		unsigned int step, unsigned int size)
+{
+	int position = index * step + step / 2 - 0x8000;
+
+	if (position < 0)
+		return 0;
+	if (position > (int) (size - 1) << 16)
+		return (size - 1) << 16;
+	return position;
+}
+
+static void tiled_scale_bilinear(const struct tiled_scale *scale,
+		unsigned int first, unsigned int last)
+{
+	unsigned int step_x = (scale->width << 16) / scale->dst_width;
+	unsigned int step_y = (scale->height << 16) / scale->dst_height;
+	unsigned int i, j, c;
+
+	for (j = first; j < last; j++)
+	{
+		unsigned int sy = tiled_scale_position(j, step_y, scale->height);
+		unsigned int fy = (sy >> 8) & 0xff;
+		const uint8_t *top = tiled_scale_line(scale, sy >> 16);
+		const uint8_t *bottom = fy ?
+				tiled_scale_line(scale, (sy >> 16) + 1) : top;
+
+		for (i = 0; i < scale->dst_width; i++)
+		{
+			unsigned int sx = tiled_scale_position(i, step_x,
+					scale->width);
+			unsigned int fx = (sx >> 8) & 0xff;
+			unsigned int x0 = sx >> 16;
+			unsigned int x1 = fx ? x0 + 1 : x0;
+
+			for (c = 0; c < scale->components; c++)
+			{
+				unsigned int t = tiled_scale_sample(scale, top,
+						x0, c) * (256 - fx) +
+						tiled_scale_sample(scale, top,
+						x1, c) * fx;
+				unsigned int b = tiled_scale_sample(scale,
+						bottom, x0, c) * (256 - fx) +
+						tiled_scale_sample(scale,
+						bottom, x1, c) * fx;
+
+				tiled_scale_store(scale, j, i, c,
+						(t * (256 - fy) + b * fy +
+						0x8000) >> 16);
+			}
+		}
+	}
+}
+
+void tiled_scale_lines(const struct tiled_scale *scale, unsigned int first,
+                       unsigned int last)
+{
+	unsigned int factor;
+
+	for (factor = 2; factor <= 4; factor *= 2)
+	{
+		if (scale->width == scale->dst_width * factor &&
+		    scale->height == scale->dst_height * factor)
+		{
+			tiled_scale_box(scale, factor, first, last);
+			return;
+		}
+	}
+
+	tiled_scale_bilinear(scale, first, last);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef __TILED_SCALE_H__
+#define __TILED_SCALE_H__
+
+/*
+ * Scaling of the width x height region at (x, y) of a tiled plane src_width
+ * bytes wide to dst_width x dst_height samples. A sample is made of one byte
+ * per component: one for luma, two for interleaved chroma. Components are
+ * interleaved in dst1 when dst2 is NULL, otherwise the second one goes to dst2.
+ * Coordinates and sizes are in samples.
+ */
+struct tiled_scale {
+	void *src;
+	unsigned int src_width;
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+	unsigned int components;
+	void *dst1;
+	void *dst2;
+	unsigned int dst_pitch;
+	unsigned int dst_width;
+	unsigned int dst_height;
+};
+
+/*
+ * Computes the destination lines first to last - 1. Exact 2x and 4x
+ * reductions are box filtered, other sizes are interpolated bilinearly.
+ */
+void tiled_scale_lines(const struct tiled_scale *scale, unsigned int first,
+                       unsigned int last);
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *               2014 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Portable version of the tiled to planar converters and runtime selection of
+ * the SIMD implementation. The C code walks the 32x32 tiles exactly like the
+ * assembly does and is the reference the other implementations must match
+ * byte for byte.
+ */
+
+#include "config.h"
+
+#include "tiled_yuv.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__arm__)
+#include <sys/auxv.h>
+
+#ifndef HWCAP_ARM_NEON
+#define HWCAP_ARM_NEON	(1 << 12)
+#endif
+#endif
+
+struct tiled_yuv_impl {
+	const char *name;
+	int (*supported)(void);
+	void (*to_planar)(void *src, void *dst, unsigned int dst_pitch,
+			unsigned int width, unsigned int height);
+	void (*deinterleave_to_planar)(void *src, void *dst1, void *dst2,
+			unsigned int dst_pitch, unsigned int width,
+			unsigned int height);
+};
+
+static int tiled_yuv_always(void)
+{
+	return 1;
+}
+
+int tiled_has_neon(void)
+{
+#if defined(__aarch64__)
+	return 1;
+#elif defined(__arm__)
+	return !!(getauxval(AT_HWCAP) & HWCAP_ARM_NEON);
+#else
+	return 0;
+#endif
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+static int tiled_yuv_has_sse2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+static int tiled_yuv_has_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+/* Ordered from the slowest to the fastest */
+static const struct tiled_yuv_impl tiled_yuv_impls[] = {
+	{ "c", tiled_yuv_always, tiled_to_planar_c,
+		tiled_deinterleave_to_planar_c },
+#if defined(__arm__) || defined(__aarch64__)
+	{ "neon", tiled_has_neon, tiled_to_planar_neon,
+		tiled_deinterleave_to_planar_neon },
+#endif
+#if defined(__i386__) || defined(__x86_64__)
+	{ "sse2", tiled_yuv_has_sse2, tiled_to_planar_sse2,
+		tiled_deinterleave_to_planar_sse2 },
+	{ "avx2", tiled_yuv_has_avx2, tiled_to_planar_avx2,
+		tiled_deinterleave_to_planar_avx2 },
+#endif
+};
+
+#define TILED_YUV_NB_IMPLS (sizeof(tiled_yuv_impls) / sizeof(tiled_yuv_impls[0]))
+
+static const struct tiled_yuv_impl *tiled_yuv_impl = &tiled_yuv_impls[0];
+
+/* Set when the CPU runs the NEON intrinsics of tiled_neon.c */
+static int tiled_yuv_neon;
+
+const char *tiled_yuv_init(const char *name)
+{
+	unsigned int i;
+
+	tiled_yuv_impl = &tiled_yuv_impls[0];
+	tiled_yuv_neon = tiled_has_neon();
+	for (i = 0; i < TILED_YUV_NB_IMPLS; i++)
+	{
+		if (!tiled_yuv_impls[i].supported())
+			continue;
+		if (name && strcmp(name, tiled_yuv_impls[i].name) == 0)
+			return (tiled_yuv_impl = &tiled_yuv_impls[i])->name;
+		tiled_yuv_impl = &tiled_yuv_impls[i];
+	}
+
+	return tiled_yuv_impl->name;
+}
+
+void tiled_to_planar(void *src, void *dst, unsigned int dst_pitch,
+                     unsigned int width, unsigned int height)
+{
+	tiled_yuv_impl->to_planar(src, dst, dst_pitch, width, height);
+}
+
+void tiled_deinterleave_to_planar(void *src, void *dst1, void *dst2,
+                                  unsigned int dst_pitch,
+                                  unsigned int width, unsigned int height)
+{
+	tiled_yuv_impl->deinterleave_to_planar(src, dst1, dst2, dst_pitch,
+			width, height);
+}
+
+/*
+ * Tiles are stored line after line, each line of tiles being made of
+ * ALIGN(width, 32) / 32 tiles of 32x32 bytes.
+ */
+#define TILE_LINE(width)	((size_t) (((width) + 31) & ~31) * 32)
+
+void tiled_to_planar_region(void *src, unsigned int src_width,
+                            unsigned int x, unsigned int y,
+                            void *dst, unsigned int dst_pitch,
+                            unsigned int width, unsigned int height)
+{
+	size_t tile_line = TILE_LINE(src_width);
+	unsigned int i, j, span;
+
+	/* Whole lines of tiles can go through the optimized converters */
+	if (x == 0 && y % 32 == 0 && TILE_LINE(width) == tile_line)
+	{
+		tiled_to_planar((uint8_t *) src + (y / 32) * tile_line, dst,
+				dst_pitch, width, height);
+		return;
+	}
+
+	for (j = 0; j < height; j++)
+	{
+		const uint8_t *s = (const uint8_t *) src +
+				((y + j) / 32) * tile_line + ((y + j) % 32) * 32;
+		uint8_t *d = (uint8_t *) dst + (size_t) j * dst_pitch;
+
+		for (i = x; i < x + width; i += span, d += span)
+		{
+			span = 32 - i % 32;
+			if (span > x + width - i)
+				span = x + width - i;
+			memcpy(d, s + (i / 32) * 1024 + i % 32, span);
+		}
+	}
+}
+
+void tiled_deinterleave_to_planar_region(void *src, unsigned int src_width,
+                                         unsigned int x, unsigned int y,
+                                         void *dst1, void *dst2,
+                                         unsigned int dst_pitch,
+                                         unsigned int width,
+                                         unsigned int height)
+{
+	size_t tile_line = TILE_LINE(src_width);
+	unsigned int i, j;
+
+	if (x == 0 && y % 32 == 0 && TILE_LINE(width) == tile_line)
+	{
+		tiled_deinterleave_to_planar((uint8_t *) src +
+				(y / 32) * tile_line, dst1, dst2, dst_pitch,
+				width, height);
+		return;
+	}
+
+	for (j = 0; j < height; j++)
+	{
+		const uint8_t *s = (const uint8_t *) src +
+				((y + j) / 32) * tile_line + ((y + j) % 32) * 32;
+		uint8_t *d1 = (uint8_t *) dst1 + (size_t) j * dst_pitch;
+		uint8_t *d2 = (uint8_t *) dst2 + (size_t) j * dst_pitch;
+
+		for (i = x; i + 1 < x + width; i += 2)
+		{
+			const uint8_t *p = s + (i / 32) * 1024 + i % 32;
+
+			*d1++ = p[0];
+			*d2++ = p[1];
+		}
+	}
+}
+
+void tiled_to_planar_c(void *src, void *dst, unsigned int dst_pitch,
+                       unsigned int width, unsigned int height)
+{
+	size_t tile_line = TILE_LINE(width);
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		const uint8_t *s = (const uint8_t *) src + (y / 32) * tile_line +
+				(y % 32) * 32;
+		uint8_t *d = (uint8_t *) dst + (size_t) y * dst_pitch;
+
+		for (x = 0; x + 32 <= width; x += 32, s += 1024)
+			memcpy(d + x, s, 32);
+		if (x < width)
+			memcpy(d + x, s, width - x);
+	}
+}
+
+void tiled_deinterleave_to_planar_c(void *src, void *dst1, void *dst2,
+                                    unsigned int dst_pitch,
+                                    unsigned int width, unsigned int height)
+{
+	size_t tile_line = TILE_LINE(width);
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		const uint8_t *s = (const uint8_t *) src + (y / 32) * tile_line +
+				(y % 32) * 32;
+		uint8_t *d1 = (uint8_t *) dst1 + (size_t) y * dst_pitch;
+		uint8_t *d2 = (uint8_t *) dst2 + (size_t) y * dst_pitch;
+
+		for (x = 0; x < width / 2; x++)
+		{
+			const uint8_t *p = s + (x / 16) * 1024 + (x % 16) * 2;
+
+			d1[x] = p[0];
+			d2[x] = p[1];
+		}
+	}
+}
+
+/*
+ * Fletcher like checksum of the tile seen as 256 little endian words: the sum
+ * of the words and the sum of the words weighted by their position
+ */
+uint64_t tiled_signature_c(const void *tile)
+{
+	const uint8_t *t = tile;
+	uint32_t sum = 0, weighted = 0, word;
+	unsigned int i;
+
+	for (i = 0; i < 256; i++)
+	{
+		memcpy(&word, t + i * 4, 4);
+		sum += word;
+		weighted += word * (i + 1);
+	}
+
+	return (uint64_t) weighted << 32 | sum;
+}
+
+uint64_t tiled_signature(const void *tile)
+{
+#ifdef HAVE_NEON_INTRINSICS
+	if (tiled_yuv_neon)
+		return tiled_signature_neon(tile);
+#endif
+	return tiled_signature_c(tile);
+}
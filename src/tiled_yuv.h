@@ -20,6 +20,19 @@
 #ifndef __TILED_YUV_H__
 #define __TILED_YUV_H__
 
+#include <stdint.h>
+
+/*
+ * Selects the converters used by tiled_to_planar and
+ * tiled_deinterleave_to_planar. When name is NULL or isn't available on this
+ * CPU, the fastest supported implementation is picked. Returns the name of the
+ * selected implementation ("c", "neon", "sse2" or "avx2").
+ */
+const char *tiled_yuv_init(const char *name);
+
+/* Whether the CPU has NEON, checked at runtime on 32-bit ARM */
+int tiled_has_neon(void);
+
 void tiled_to_planar(void *src, void *dst, unsigned int dst_pitch,
                      unsigned int width, unsigned int height);
 
@@ -27,4 +40,69 @@ void tiled_deinterleave_to_planar(void *src, void *dst1, void *dst2,
                                   unsigned int dst_pitch,
                                   unsigned int width, unsigned int height);
 
+/*
+ * Converts the width x height region at (x, y) of a tiled plane src_width
+ * bytes wide, only reading the tiles intersecting that region.
+ */
+void tiled_to_planar_region(void *src, unsigned int src_width,
+                            unsigned int x, unsigned int y,
+                            void *dst, unsigned int dst_pitch,
+                            unsigned int width, unsigned int height);
+
+/*
+ * Same as tiled_to_planar_region for an interleaved plane, x and width are in
+ * bytes and must be even
+ */
+void tiled_deinterleave_to_planar_region(void *src, unsigned int src_width,
+                                         unsigned int x, unsigned int y,
+                                         void *dst1, void *dst2,
+                                         unsigned int dst_pitch,
+                                         unsigned int width,
+                                         unsigned int height);
+
+/*
+ * Returns a checksum of the 1024 bytes of a tile, used to find the tiles that
+ * changed since the previous frame
+ */
+uint64_t tiled_signature(const void *tile);
+
+uint64_t tiled_signature_c(const void *tile);
+
+#if defined(__arm__) || defined(__aarch64__)
+uint64_t tiled_signature_neon(const void *tile);
+#endif
+
+/* Portable reference implementation */
+void tiled_to_planar_c(void *src, void *dst, unsigned int dst_pitch,
+                       unsigned int width, unsigned int height);
+
+void tiled_deinterleave_to_planar_c(void *src, void *dst1, void *dst2,
+                                    unsigned int dst_pitch,
+                                    unsigned int width, unsigned int height);
+
+#if defined(__arm__) || defined(__aarch64__)
+void tiled_to_planar_neon(void *src, void *dst, unsigned int dst_pitch,
+                          unsigned int width, unsigned int height);
+
+void tiled_deinterleave_to_planar_neon(void *src, void *dst1, void *dst2,
+                                       unsigned int dst_pitch,
+                                       unsigned int width, unsigned int height);
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+void tiled_to_planar_sse2(void *src, void *dst, unsigned int dst_pitch,
+                          unsigned int width, unsigned int height);
+
+void tiled_deinterleave_to_planar_sse2(void *src, void *dst1, void *dst2,
+                                       unsigned int dst_pitch,
+                                       unsigned int width, unsigned int height);
+
+void tiled_to_planar_avx2(void *src, void *dst, unsigned int dst_pitch,
+                          unsigned int width, unsigned int height);
+
+void tiled_deinterleave_to_planar_avx2(void *src, void *dst1, void *dst2,
+                                       unsigned int dst_pitch,
+                                       unsigned int width, unsigned int height);
+#endif
+
 #endif
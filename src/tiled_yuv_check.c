@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Checks every tiled to planar implementation supported by the CPU against the
+ * C one on random widths, heights and pitches, bytes outside of the converted
+ * region included, then prints their throughput on 1080p planes. Run by
+ * make check, it fails on the first difference.
+ */
+
+#include "tiled_yuv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CHECK_ROUNDS		200
+#define BENCH_ROUNDS		200
+#define BENCH_WIDTH		1920
+#define BENCH_HEIGHT		1088
+
+#define TILE_LINE(width)	((size_t) (((width) + 31) & ~31) * 32)
+
+static const char *const check_impls[] = { "c", "neon", "sse2", "avx2" };
+
+#define CHECK_NB_IMPLS	(sizeof(check_impls) / sizeof(check_impls[0]))
+
+static void check_fill(uint8_t *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		data[i] = rand();
+}
+
+static size_t check_src_size(unsigned int width, unsigned int height)
+{
+	return TILE_LINE(width) * ((height + 31) / 32);
+}
+
+/* Return 0 when name converts the plane exactly like the C version */
+static int check_plane(const char *name, unsigned int width,
+		unsigned int height, unsigned int pitch, int deinterleave)
+{
+	size_t src_size = check_src_size(width, height);
+	size_t dst_size = (size_t) pitch * height;
+	uint8_t *src = malloc(src_size);
+	uint8_t *ref = malloc(2 * dst_size);
+	uint8_t *dst = malloc(2 * dst_size);
+	int ret;
+
+	if (!src || !ref || !dst)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	check_fill(src, src_size);
+	memset(ref, 0xaa, 2 * dst_size);
+	memset(dst, 0xaa, 2 * dst_size);
+
+	if (deinterleave)
+	{
+		tiled_deinterleave_to_planar_c(src, ref, ref + dst_size, pitch,
+				width, height);
+		tiled_deinterleave_to_planar(src, dst, dst + dst_size, pitch,
+				width, height);
+	}
+	else
+	{
+		tiled_to_planar_c(src, ref, pitch, width, height);
+		tiled_to_planar(src, dst, pitch, width, height);
+	}
+
+	ret = memcmp(ref, dst, 2 * dst_size);
+	if (ret)
+		fprintf(stderr, "%s: %s differs for %ux%u, pitch %u\n", name,
+				deinterleave ? "deinterleave" : "to_planar",
+				width, height, pitch);
+
+	free(src);
+	free(ref);
+	free(dst);
+
+	return ret;
+}
+
+static int check_signature(void)
+{
+	uint8_t tile[1024];
+	int i;
+
+	for (i = 0; i < CHECK_ROUNDS; i++)
+	{
+		check_fill(tile, sizeof(tile));
+		if (tiled_signature(tile) != tiled_signature_c(tile))
+		{
+			fprintf(stderr, "tiled_signature differs\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static double check_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Prints the throughput in MB of planar data written per second */
+static void check_bench(const char *name)
+{
+	size_t luma_size = (size_t) BENCH_WIDTH * BENCH_HEIGHT;
+	uint8_t *src = malloc(check_src_size(BENCH_WIDTH, BENCH_HEIGHT));
+	uint8_t *dst = malloc(luma_size);
+	double start, luma, chroma;
+	int i;
+
+	if (!src || !dst)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	check_fill(src, check_src_size(BENCH_WIDTH, BENCH_HEIGHT));
+
+	start = check_now();
+	for (i = 0; i < BENCH_ROUNDS; i++)
+		tiled_to_planar(src, dst, BENCH_WIDTH, BENCH_WIDTH,
+				BENCH_HEIGHT);
+	luma = check_now() - start;
+
+	start = check_now();
+	for (i = 0; i < BENCH_ROUNDS; i++)
+		tiled_deinterleave_to_planar(src, dst, dst + luma_size / 4,
+				BENCH_WIDTH / 2, BENCH_WIDTH,
+				BENCH_HEIGHT / 2);
+	chroma = check_now() - start;
+
+	printf("%-5s to_planar %7.1f MB/s, deinterleave %7.1f MB/s\n", name,
+			BENCH_ROUNDS * luma_size / luma / 1e6,
+			BENCH_ROUNDS * luma_size / 2 / chroma / 1e6);
+
+	free(src);
+	free(dst);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i, j;
+	int ret = 0;
+
+	srand(1);
+
+	if (check_signature())
+		ret = 1;
+
+	for (i = 0; i < CHECK_NB_IMPLS; i++)
+	{
+		const char *name = check_impls[i];
+
+		/* Unsupported implementations fall back to another one */
+		if (strcmp(tiled_yuv_init(name), name) != 0)
+			continue;
+
+		for (j = 0; j < CHECK_ROUNDS; j++)
+		{
+			unsigned int width = 2 + rand() % 2048 / 2 * 2;
+			unsigned int height = 1 + rand() % 256;
+			unsigned int pitch = width + rand() % 64;
+
+			if (check_plane(name, width, height, pitch, 0) ||
+			    check_plane(name, width, height, pitch / 2, 1))
+			{
+				ret = 1;
+				break;
+			}
+		}
+
+		check_bench(name);
+	}
+
+	return ret;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * SSE2 and AVX2 versions of the tiled to planar converters. They are only
+ * useful to run the driver's conversion code on development machines and are
+ * built with target attributes so that the rest of the driver doesn't need any
+ * specific compiler flag. tiled_yuv_init picks one of them at runtime.
+ */
+
+#if defined(__i386__) || defined(__x86_64__)
+
+#include "tiled_yuv.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <immintrin.h>
+
+/* Copies the bytes of the last, incomplete, tile of a line */
+static inline void tiled_copy_rest(const uint8_t *s, uint8_t *d,
+		unsigned int rest)
+{
+	while (rest--)
+		*d++ = *s++;
+}
+
+static inline void tiled_deinterleave_rest(const uint8_t *s, uint8_t *d1,
+		uint8_t *d2, unsigned int rest)
+{
+	while (rest--)
+	{
+		*d1++ = *s++;
+		*d2++ = *s++;
+	}
+}
+
+__attribute__((target("sse2")))
+void tiled_to_planar_sse2(void *src, void *dst, unsigned int dst_pitch,
+                          unsigned int width, unsigned int height)
+{
+	size_t tile_line = (size_t) ((width + 31) & ~31) * 32;
+	unsigned int ntiles = width / 32;
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		const uint8_t *s = (const uint8_t *) src + (y / 32) * tile_line +
+				(y % 32) * 32;
+		uint8_t *d = (uint8_t *) dst + (size_t) y * dst_pitch;
+
+		for (x = 0; x < ntiles; x++, s += 1024, d += 32)
+		{
+			__m128i a, b;
+
+			_mm_prefetch((const char *) s + 1024, _MM_HINT_T0);
+			a = _mm_loadu_si128((const __m128i *) s);
+			b = _mm_loadu_si128((const __m128i *) (s + 16));
+			_mm_storeu_si128((__m128i *) d, a);
+			_mm_storeu_si128((__m128i *) (d + 16), b);
+		}
+
+		tiled_copy_rest(s, d, width % 32);
+	}
+}
+
+__attribute__((target("sse2")))
+void tiled_deinterleave_to_planar_sse2(void *src, void *dst1, void *dst2,
+                                       unsigned int dst_pitch,
+                                       unsigned int width, unsigned int height)
+{
+	size_t tile_line = (size_t) ((width + 31) & ~31) * 32;
+	unsigned int ntiles = width / 32;
+	__m128i mask = _mm_set1_epi16(0x00ff);
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		const uint8_t *s = (const uint8_t *) src + (y / 32) * tile_line +
+				(y % 32) * 32;
+		uint8_t *d1 = (uint8_t *) dst1 + (size_t) y * dst_pitch;
+		uint8_t *d2 = (uint8_t *) dst2 + (size_t) y * dst_pitch;
+
+		for (x = 0; x < ntiles; x++, s += 1024, d1 += 16, d2 += 16)
+		{
+			__m128i a, b, u, v;
+
+			_mm_prefetch((const char *) s + 1024, _MM_HINT_T0);
+			a = _mm_loadu_si128((const __m128i *) s);
+			b = _mm_loadu_si128((const __m128i *) (s + 16));
+			u = _mm_packus_epi16(_mm_and_si128(a, mask),
+					_mm_and_si128(b, mask));
+			v = _mm_packus_epi16(_mm_srli_epi16(a, 8),
+					_mm_srli_epi16(b, 8));
+			_mm_storeu_si128((__m128i *) d1, u);
+			_mm_storeu_si128((__m128i *) d2, v);
+		}
+
+		tiled_deinterleave_rest(s, d1, d2, (width / 2) % 16);
+	}
+}
+
+__attribute__((target("avx2")))
+void tiled_to_planar_avx2(void *src, void *dst, unsigned int dst_pitch,
+                          unsigned int width, unsigned int height)
+{
+	size_t tile_line = (size_t) ((width + 31) & ~31) * 32;
+	unsigned int ntiles = width / 32;
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		const uint8_t *s = (const uint8_t *) src + (y / 32) * tile_line +
+				(y % 32) * 32;
+		uint8_t *d = (uint8_t *) dst + (size_t) y * dst_pitch;
+
+		for (x = 0; x < ntiles; x++, s += 1024, d += 32)
+		{
+			_mm_prefetch((const char *) s + 1024, _MM_HINT_T0);
+			_mm256_storeu_si256((__m256i *) d,
+					_mm256_loadu_si256((const __m256i *) s));
+		}
+
+		tiled_copy_rest(s, d, width % 32);
+	}
+}
+
+__attribute__((target("avx2")))
+void tiled_deinterleave_to_planar_avx2(void *src, void *dst1, void *dst2,
+                                       unsigned int dst_pitch,
+                                       unsigned int width, unsigned int height)
+{
+	size_t tile_line = (size_t) ((width + 31) & ~31) * 32;
+	unsigned int ntiles = width / 32;
+	/* Gathers even bytes in the low half of each lane, odd in the high */
+	__m256i shuffle = _mm256_setr_epi8(
+			0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+			0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		const uint8_t *s = (const uint8_t *) src + (y / 32) * tile_line +
+				(y % 32) * 32;
+		uint8_t *d1 = (uint8_t *) dst1 + (size_t) y * dst_pitch;
+		uint8_t *d2 = (uint8_t *) dst2 + (size_t) y * dst_pitch;
+
+		for (x = 0; x < ntiles; x++, s += 1024, d1 += 16, d2 += 16)
+		{
+			__m256i a;
+
+			_mm_prefetch((const char *) s + 1024, _MM_HINT_T0);
+			a = _mm256_loadu_si256((const __m256i *) s);
+			a = _mm256_shuffle_epi8(a, shuffle);
+			a = _mm256_permute4x64_epi64(a, _MM_SHUFFLE(3, 1, 2, 0));
+			_mm_storeu_si128((__m128i *) d1,
+					_mm256_castsi256_si128(a));
+			_mm_storeu_si128((__m128i *) d2,
+					_mm256_extracti128_si256(a, 1));
+		}
+
+		tiled_deinterleave_rest(s, d1, d2, (width / 2) % 16);
+	}
+}
+
+#endif
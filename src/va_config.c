@@ -25,6 +25,7 @@
 
 #include "sunxi_cedrus_drv_video.h"
 #include "va_config.h"
+#include "surface.h"
 
 #include <assert.h>
 #include <string.h>
@@ -255,15 +256,99 @@ VAStatus sunxi_cedrus_QueryConfigAttributes(VADriverContextP ctx,
 	return vaStatus;
 }
 
-/* sunxi-cedrus doesn't support display attributes */
+/*
+ * The only display attribute is the rotation of the images converted from the
+ * surfaces, the private mirroring bits being applied before the rotation
+ */
+static void sunxi_cedrus_rotation_attribute(
+		struct sunxi_cedrus_driver_data *driver_data,
+		VADisplayAttribute *attr)
+{
+	attr->type = VADisplayAttribRotation;
+	attr->min_value = VA_ROTATION_NONE;
+	attr->max_value = VA_ROTATION_270 | SUNXI_CEDRUS_MIRROR_HORIZONTAL |
+		SUNXI_CEDRUS_MIRROR_VERTICAL;
+	attr->value = driver_data->rotation |
+		driver_data->mirror << SUNXI_CEDRUS_MIRROR_SHIFT;
+	attr->flags = VA_DISPLAY_ATTRIB_GETTABLE | VA_DISPLAY_ATTRIB_SETTABLE;
+}
+
 VAStatus sunxi_cedrus_QueryDisplayAttributes (VADriverContextP ctx,
 		VADisplayAttribute *attr_list, int *num_attributes)
-{ return VA_STATUS_ERROR_UNKNOWN; }
+{
+	INIT_DRIVER_DATA
+
+	sunxi_cedrus_rotation_attribute(driver_data, &attr_list[0]);
+	*num_attributes = 1;
+
+	return VA_STATUS_SUCCESS;
+}
 
 VAStatus sunxi_cedrus_GetDisplayAttributes (VADriverContextP ctx,
 		VADisplayAttribute *attr_list, int num_attributes)
-{ return VA_STATUS_ERROR_UNKNOWN; }
+{
+	INIT_DRIVER_DATA
+	int i;
+
+	for (i = 0; i < num_attributes; i++)
+	{
+		if (attr_list[i].type == VADisplayAttribRotation)
+			sunxi_cedrus_rotation_attribute(driver_data,
+					&attr_list[i]);
+		else
+			attr_list[i].flags = VA_DISPLAY_ATTRIB_NOT_SUPPORTED;
+	}
+
+	return VA_STATUS_SUCCESS;
+}
 
 VAStatus sunxi_cedrus_SetDisplayAttributes (VADriverContextP ctx,
 		VADisplayAttribute *attr_list, int num_attributes)
-{ return VA_STATUS_ERROR_UNKNOWN; }
+{
+	INIT_DRIVER_DATA
+	object_heap_iterator iter;
+	object_surface_p obj_surface;
+	unsigned int rotation = driver_data->rotation;
+	unsigned int mirror = driver_data->mirror;
+	int i, value;
+
+	/* Nothing is applied unless the whole list is valid */
+	for (i = 0; i < num_attributes; i++)
+	{
+		if (attr_list[i].type != VADisplayAttribRotation)
+			return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+
+		value = attr_list[i].value;
+		if (value & ~(SUNXI_CEDRUS_ROTATION_MASK |
+		    SUNXI_CEDRUS_MIRROR_HORIZONTAL |
+		    SUNXI_CEDRUS_MIRROR_VERTICAL) ||
+		    (value & SUNXI_CEDRUS_ROTATION_MASK) > VA_ROTATION_270)
+			return VA_STATUS_ERROR_INVALID_PARAMETER;
+	}
+
+	for (i = 0; i < num_attributes; i++)
+	{
+		rotation = attr_list[i].value & SUNXI_CEDRUS_ROTATION_MASK;
+		mirror = attr_list[i].value >> SUNXI_CEDRUS_MIRROR_SHIFT;
+	}
+
+	if (driver_data->rotation == rotation && driver_data->mirror == mirror)
+		return VA_STATUS_SUCCESS;
+
+	/*
+	 * Images converted with the previous orientation can't be handed out,
+	 * they are dropped before the new one is used to size Images
+	 */
+	obj_surface = (object_surface_p) object_heap_first(&driver_data->surface_heap, &iter);
+	while (obj_surface)
+	{
+		sunxi_cedrus_drop_prefetched_image(ctx, obj_surface);
+		obj_surface = (object_surface_p) object_heap_next(&driver_data->surface_heap, &iter);
+	}
+	sunxi_cedrus_image_pool_flush(driver_data);
+
+	driver_data->rotation = rotation;
+	driver_data->mirror = mirror;
+
+	return VA_STATUS_SUCCESS;
+}
@@ -33,6 +33,15 @@
 #define CONFIG(id)  ((object_config_p)  object_heap_lookup(&driver_data->config_heap,  id))
 #define CONFIG_ID_OFFSET		0x01000000
 
+/*
+ * Private bits of the VADisplayAttribRotation value, mirroring the images
+ * before rotating them. The VA_ROTATION_* values are in the low bits.
+ */
+#define SUNXI_CEDRUS_ROTATION_MASK		0xff
+#define SUNXI_CEDRUS_MIRROR_SHIFT		8
+#define SUNXI_CEDRUS_MIRROR_HORIZONTAL		(1 << 8)
+#define SUNXI_CEDRUS_MIRROR_VERTICAL		(1 << 9)
+
 struct object_config {
 	struct object_base base;
 	VAProfile profile;
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "worker.h"
+
+#include <stddef.h>
+
+/*
+ * A small pool of persistent threads used to spread CPU heavy work, like the
+ * tiled to planar conversion, over all the cores. Jobs are picked in order
+ * from a single queue and a thread waiting for a job helps running the queue
+ * until that job is done, so with a single thread everything simply runs
+ * synchronously in the caller.
+ */
+
+/* Must be called with the mutex held */
+static struct sunxi_cedrus_job *sunxi_cedrus_workers_pop(
+		struct sunxi_cedrus_workers *workers)
+{
+	struct sunxi_cedrus_job *job = workers->first;
+
+	if (job)
+	{
+		workers->first = job->next;
+		if (workers->first == NULL)
+			workers->last = NULL;
+	}
+
+	return job;
+}
+
+/* Must be called with the mutex held, it is released while the job runs */
+static void sunxi_cedrus_workers_run(struct sunxi_cedrus_workers *workers,
+		struct sunxi_cedrus_job *job)
+{
+	pthread_mutex_unlock(&workers->mutex);
+	job->func(job->arg);
+	pthread_mutex_lock(&workers->mutex);
+
+	job->done = 1;
+	pthread_cond_broadcast(&workers->done_cond);
+}
+
+static void *sunxi_cedrus_worker(void *arg)
+{
+	struct sunxi_cedrus_workers *workers = arg;
+	struct sunxi_cedrus_job *job;
+
+	pthread_mutex_lock(&workers->mutex);
+	while (1)
+	{
+		job = sunxi_cedrus_workers_pop(workers);
+		if (job)
+			sunxi_cedrus_workers_run(workers, job);
+		else if (workers->stop)
+			break;
+		else
+			pthread_cond_wait(&workers->work_cond, &workers->mutex);
+	}
+	pthread_mutex_unlock(&workers->mutex);
+
+	return NULL;
+}
+
+int sunxi_cedrus_workers_init(struct sunxi_cedrus_workers *workers,
+		int num_threads)
+{
+	int i;
+
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > SUNXI_CEDRUS_MAX_WORKERS)
+		num_threads = SUNXI_CEDRUS_MAX_WORKERS;
+
+	pthread_mutex_init(&workers->mutex, NULL);
+	pthread_cond_init(&workers->work_cond, NULL);
+	pthread_cond_init(&workers->done_cond, NULL);
+	workers->first = NULL;
+	workers->last = NULL;
+	workers->stop = 0;
+	workers->num_threads = 1;
+
+	for (i = 0; i < num_threads - 1; i++)
+	{
+		if (pthread_create(&workers->threads[i], NULL,
+				sunxi_cedrus_worker, workers))
+			return -1;
+		workers->num_threads++;
+	}
+
+	return 0;
+}
+
+void sunxi_cedrus_workers_queue(struct sunxi_cedrus_workers *workers,
+		struct sunxi_cedrus_job *job, sunxi_cedrus_job_func func,
+		void *arg)
+{
+	job->func = func;
+	job->arg = arg;
+	job->done = 0;
+	job->next = NULL;
+
+	pthread_mutex_lock(&workers->mutex);
+	if (workers->last)
+		workers->last->next = job;
+	else
+		workers->first = job;
+	workers->last = job;
+	pthread_cond_signal(&workers->work_cond);
+	pthread_mutex_unlock(&workers->mutex);
+}
+
+void sunxi_cedrus_workers_wait(struct sunxi_cedrus_workers *workers,
+		struct sunxi_cedrus_job *job)
+{
+	struct sunxi_cedrus_job *pending;
+
+	pthread_mutex_lock(&workers->mutex);
+	while (!job->done)
+	{
+		pending = sunxi_cedrus_workers_pop(workers);
+		if (pending)
+			sunxi_cedrus_workers_run(workers, pending);
+		else
+			pthread_cond_wait(&workers->done_cond, &workers->mutex);
+	}
+	pthread_mutex_unlock(&workers->mutex);
+}
+
+void sunxi_cedrus_workers_destroy(struct sunxi_cedrus_workers *workers)
+{
+	int i;
+
+	pthread_mutex_lock(&workers->mutex);
+	workers->stop = 1;
+	pthread_cond_broadcast(&workers->work_cond);
+	pthread_mutex_unlock(&workers->mutex);
+
+	for (i = 0; i < workers->num_threads - 1; i++)
+		pthread_join(workers->threads[i], NULL);
+
+	pthread_cond_destroy(&workers->done_cond);
+	pthread_cond_destroy(&workers->work_cond);
+	pthread_mutex_destroy(&workers->mutex);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2016 Florent Revest, <florent.revest@free-electrons.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _WORKER_H_
+#define _WORKER_H_
+
+#include <pthread.h>
+
+#define SUNXI_CEDRUS_MAX_WORKERS	8
+
+typedef void (*sunxi_cedrus_job_func)(void *arg);
+
+struct sunxi_cedrus_job {
+	sunxi_cedrus_job_func func;
+	void *arg;
+	int done;
+	struct sunxi_cedrus_job *next;
+};
+
+struct sunxi_cedrus_workers {
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct sunxi_cedrus_job *first;
+	struct sunxi_cedrus_job *last;
+	pthread_t threads[SUNXI_CEDRUS_MAX_WORKERS];
+	int num_threads;
+	int stop;
+};
+
+/*
+ * Starts num_threads - 1 workers, the thread waiting for a job is the last one
+ * Return 0 on success, -1 on error
+ */
+int sunxi_cedrus_workers_init(struct sunxi_cedrus_workers *workers,
+		int num_threads);
+
+/*
+ * Queues a job, it will be run by the first idle worker
+ */
+void sunxi_cedrus_workers_queue(struct sunxi_cedrus_workers *workers,
+		struct sunxi_cedrus_job *job, sunxi_cedrus_job_func func,
+		void *arg);
+
+/*
+ * Waits for a job to be done, running pending jobs in the meantime
+ */
+void sunxi_cedrus_workers_wait(struct sunxi_cedrus_workers *workers,
+		struct sunxi_cedrus_job *job);
+
+/*
+ * Stops the workers once they are done with the pending jobs
+ */
+void sunxi_cedrus_workers_destroy(struct sunxi_cedrus_workers *workers);
+
+#endif /* _WORKER_H_ */